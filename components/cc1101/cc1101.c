@@ -7,14 +7,19 @@
  * Hardware interface to TI CC1101 radio chip
  *
  */
+#include <string.h>
+
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
 
 #define TAG "CC1101"
 #include "esp_log.h"
 
 #include "cc1101_param.h"
 #include "cc1101.h"
+#include "cc_cmd.h"
 
 /************************************************************
  * CC1101 SPI device configuration
@@ -35,7 +40,7 @@ static spi_bus_config_t const cc_buscfg = {
 };
 
 static spi_device_interface_config_t const cc_devcfg = {
-  .clock_speed_hz = 1000000, // SPI clock is 1 MHz!
+  .clock_speed_hz = CONFIG_CC_SPI_CLOCK_KHZ * 1000,
   .queue_size = 7,
   .mode = 0, // SPI mode 0
   .spics_io_num = CONFIG_CC_CSN_GPIO,
@@ -56,7 +61,40 @@ static void cc_spi_init() {
   assert(ret==ESP_OK);
 }
 
-static bool spi_write_byte(uint8_t *status, uint8_t* Dataout, size_t DataLength )
+/************************************************************
+ * SPI transaction timing
+ */
+static struct cc_spi_stats spi_stats[CC_SPI_OP_MAX];
+
+static void spi_stats_update( enum cc_spi_op op, int64_t start ) {
+  struct cc_spi_stats *stats = spi_stats + op;
+  uint32_t t = (uint32_t)( esp_timer_get_time() - start );
+
+  stats->count++;
+  stats->total += t;
+  if( t > stats->max )
+    stats->max = t;
+}
+
+struct cc_spi_stats const *cc_spi_stats( enum cc_spi_op op ) {
+  return ( op<CC_SPI_OP_MAX ) ? spi_stats+op : NULL ;
+}
+
+void cc_spi_stats_reset( void ) {
+  memset( spi_stats, 0, sizeof(spi_stats) );
+}
+
+/************************************************************
+ * SPI transactions
+ *
+ * Transactions are short and on the critical path between frames
+ * so they are polled rather than waiting for the SPI interrupt.
+ * Sequences of transactions hold the bus with cc_spi_acquire().
+ */
+static void cc_spi_acquire( void ) { spi_device_acquire_bus( cc_handle, portMAX_DELAY ); }
+static void cc_spi_release( void ) { spi_device_release_bus( cc_handle ); }
+
+static bool spi_write_byte( enum cc_spi_op op, uint8_t *status, uint8_t* Dataout, size_t DataLength )
 {
   if ( DataLength > 0 ) {
     spi_transaction_t SPITransaction = {
@@ -65,13 +103,15 @@ static bool spi_write_byte(uint8_t *status, uint8_t* Dataout, size_t DataLength
 	  .rx_buffer = status
 	};
 
-	spi_device_transmit( cc_handle, &SPITransaction );
+    int64_t start = esp_timer_get_time();
+	spi_device_polling_transmit( cc_handle, &SPITransaction );
+    spi_stats_update( op, start );
   }
 
   return true;
 }
 
-static bool spi_read_byte(uint8_t* Datain, uint8_t* Dataout, size_t DataLength )
+static bool spi_read_byte( enum cc_spi_op op, uint8_t* Datain, uint8_t* Dataout, size_t DataLength )
 {
   if ( DataLength > 0 ) {
 	spi_transaction_t SPITransaction = {
@@ -80,7 +120,9 @@ static bool spi_read_byte(uint8_t* Datain, uint8_t* Dataout, size_t DataLength )
 	  .rx_buffer = Datain
 	};
 
-	spi_device_transmit( cc_handle, &SPITransaction );
+    int64_t start = esp_timer_get_time();
+	spi_device_polling_transmit( cc_handle, &SPITransaction );
+    spi_stats_update( op, start );
   }
 
   return true;
@@ -100,32 +142,149 @@ static uint8_t cc_read( uint8_t addr ) {
   uint8_t out[2] = { addr | CC_READ, 0 };
   uint8_t data[2] ;
 
-  spi_read_byte( data, out, 2 );
+  spi_read_byte( CC_SPI_READ, data, out, 2 );
 
   return data[1];
 }
 
 static uint8_t cc_write( uint8_t addr, uint8_t b ) {
-  uint8_t result;
+  uint8_t result[2];
 
   uint8_t out[2] = { addr, b };
-  spi_write_byte( &result, out, 2 );
+  spi_write_byte( CC_SPI_WRITE, result, out, 2 );
 
-  return result;
+  return result[0];
 }
 
 uint8_t cc_strobe( uint8_t cmd )
 {
   uint8_t result;
 
-  spi_write_byte( &result, &cmd, 1 );
+  spi_write_byte( CC_SPI_STROBE, &result, &cmd, 1 );
 
   return result;
 }
 
 uint8_t cc_write_fifo(uint8_t b) {
-  uint8_t result = cc_write( CC_FIFO, b );
-  return result & 0x0F;	// TX fifo space
+  uint8_t result[2];
+
+  uint8_t out[2] = { CC_FIFO, b };
+  spi_write_byte( CC_SPI_FIFO, result, out, 2 );
+
+  return result[0] & 0x0F;	// TX fifo space
+}
+
+/*
+ * Write a block of data in a single burst transaction
+ * Returns the status byte received with the last data byte
+ */
+#define CC_BURST_MAX CC_FIFO_SIZE
+static DMA_ATTR uint8_t burst_out[ CC_BURST_MAX+1 ];
+static DMA_ATTR uint8_t burst_status[ CC_BURST_MAX+1 ];
+
+static uint8_t cc_write_burst( enum cc_spi_op op, uint8_t addr, uint8_t const *data, uint8_t n ) {
+  uint8_t status = 0;
+
+  if( n > CC_BURST_MAX )
+    n = CC_BURST_MAX;
+
+  if( n ) {
+    burst_out[0] = addr | CC_BURST;
+    memcpy( burst_out+1, data, n );
+
+    spi_write_byte( op, burst_status, burst_out, n+1 );
+
+    status = burst_status[n];
+  }
+
+  return status;
+}
+
+/*
+ * Write a block of data to the TX FIFO in a single burst transaction
+ *
+ * The status byte returned with the last data byte reports the FIFO space
+ * before that byte was written.  The result is the space remaining after
+ * the write, the cc1101 reports at most 15 bytes.
+ */
+uint8_t cc_write_fifo_burst( uint8_t const *data, uint8_t n ) {
+  uint8_t space = 0;
+
+  if( n ) {
+    space = cc_write_burst( CC_SPI_FIFO, CC_FIFO, data, n ) & CC_FIFO_MASK;
+    if( space ) space--;
+  }
+
+  return space;
+}
+
+/************************************************************
+ * CC1101 Register shadow
+ *
+ * A copy of the configuration registers is kept so mode changes
+ * only write registers whose value changes.
+ * The FSCAL registers are updated by the cc1101 during calibration
+ * so are always written and never included in a burst.
+ */
+struct cc_reg {
+  uint8_t addr;
+  uint8_t value;
+};
+
+static uint8_t shadow[CC_PARAM_MAX];
+static uint8_t shadow_valid;
+static uint32_t shadow_hits;
+
+#define CC_REG_VOLATILE(_a) ( (_a)>=CC_FSCAL3 && (_a)<=CC_FSCAL0 )
+
+uint32_t cc_shadow_hits( void ) { return shadow_hits; }
+
+static void cc_shadow_load( uint8_t const *param, uint8_t len ) {
+  if( len > sizeof(shadow) )
+    len = sizeof(shadow);
+
+  memcpy( shadow, param, len );
+  shadow_valid = ( len==sizeof(shadow) );
+}
+
+static void cc_write_regs( struct cc_reg const *regs, uint8_t n ) {
+  uint8_t first = CC_PARAM_MAX, last = 0;
+  uint8_t nChanged = 0;
+  uint8_t i;
+
+  for( i=0 ; i<n ; i++ ) {
+    uint8_t addr = regs[i].addr;
+
+    if( addr>=CC_PARAM_MAX || !shadow_valid || CC_REG_VOLATILE(addr) ) {
+      cc_write( addr, regs[i].value );
+      if( addr<CC_PARAM_MAX ) shadow[addr] = regs[i].value;
+      continue;
+    }
+
+    if( shadow[addr]==regs[i].value ) {
+      shadow_hits++;
+      continue;
+    }
+
+    shadow[addr] = regs[i].value;
+    if( addr<first ) first = addr;
+    if( addr>last  ) last  = addr;
+    nChanged++;
+  }
+
+  if( nChanged==1 ) {
+    cc_write( first, shadow[first] );
+  } else if( nChanged>1 ) {
+    if( first<=CC_FSCAL0 && last>=CC_FSCAL3 ) { // Don't overwrite calibration
+      for( i=0 ; i<n ; i++ ) {
+        uint8_t addr = regs[i].addr;
+        if( addr<CC_PARAM_MAX && !CC_REG_VOLATILE(addr) )
+          cc_write( addr, shadow[addr] );
+      }
+    } else {
+      cc_write_burst( CC_SPI_BURST, first, shadow+first, last-first+1 );
+    }
+  }
 }
 
 /************************************************************
@@ -133,31 +292,50 @@ uint8_t cc_write_fifo(uint8_t b) {
  */
 
 void cc_enter_idle_mode(void) {
+  cc_spi_acquire();
   while ( CC_STATE( cc_strobe( CC_SIDLE ) ) != CC_STATE_IDLE );
+  cc_spi_release();
 }
 
 void cc_enter_rx_mode(void) {
+  cc_spi_acquire();
+
   while ( CC_STATE( cc_strobe( CC_SIDLE ) ) != CC_STATE_IDLE ){}
 
-  cc_write( CC_IOCFG0, 0x2E );      // GDO0 not needed
-  cc_write( CC_PKTCTRL0, 0x32 );	// Asynchronous, infinite packet
+  static struct cc_reg const rx_regs[] = {
+    { CC_IOCFG0,   0x2E },          // GDO0 not needed
+    { CC_PKTCTRL0, 0x32 },          // Asynchronous, infinite packet
+  };
+  cc_write_regs( rx_regs, sizeof(rx_regs)/sizeof(rx_regs[0]) );
 
   cc_strobe( CC_SFRX );
   while ( CC_STATE( cc_strobe( CC_SRX ) ) != CC_STATE_RX ){}
+
+  cc_spi_release();
 }
 
 void cc_enter_tx_mode(void) {
+  cc_spi_acquire();
+
   while ( CC_STATE( cc_strobe( CC_SIDLE ) ) != CC_STATE_IDLE ){}
 
-  cc_write( CC_PKTCTRL0, 0x02 );    // Fifo mode, infinite packet
-  cc_write( CC_IOCFG0, 0x02 );      // Falling edge, TX Fifo low
+  static struct cc_reg const tx_regs[] = {
+    { CC_PKTCTRL0, 0x02 },          // Fifo mode, infinite packet
+    { CC_IOCFG0,   0x02 },          // Falling edge, TX Fifo low
+  };
+  cc_write_regs( tx_regs, sizeof(tx_regs)/sizeof(tx_regs[0]) );
 
   cc_strobe( CC_SFTX );
   while ( CC_STATE( cc_strobe( CC_STX ) ) != CC_STATE_TX ){}
+
+  cc_spi_release();
 }
 
 void cc_fifo_end(void) {
-  cc_write( CC_IOCFG0, 0x05 ); 		// Rising edge, TX Fifo empty
+  static struct cc_reg const end_regs[] = {
+    { CC_IOCFG0,   0x05 },          // Rising edge, TX Fifo empty
+  };
+  cc_write_regs( end_regs, 1 );
 }
 
 uint8_t cc_read_rssi(void) {
@@ -186,28 +364,38 @@ static void cc_spi_reset(void) {
   delayMicroseconds(41);
 }
 
+static uint32_t init_time;   // uS from cc_init() to RX mode
+uint32_t cc_init_time( void ) { return init_time; }
+
 void cc_init(void) {
   uint8_t param[CC_PARAM_MAX];
-  uint8_t i,len;
+  uint8_t len;
+  int64_t start = esp_timer_get_time();
 
   esp_log_level_set(TAG, CONFIG_CC_LOG_LEVEL );
 
   cc_spi_reset();
   cc_spi_init();
 
+  cc_spi_acquire();
+
   cc_strobe(CC_SRES);
   //cc_strobe(CC_SCAL);
 
   len = cc_cfg_get( 0, param, sizeof(param) );
-  for ( i=0 ; i<len ; i++ )
-    cc_write( i, param[i] );
-
-  cc_write( CC_FIFOTHR, ( param[CC_FIFOTHR]&0xF0 )+14 );	  // TX Fifo Threshold 5
+  if( len > CC_FIFOTHR )
+    param[CC_FIFOTHR] = ( param[CC_FIFOTHR]&0xF0 )+14;	  // TX Fifo Threshold 5
+  cc_write_burst( CC_SPI_BURST, CC_IOCFG2, param, len );
+  cc_shadow_load( param, len );
 
   len = cc_pa_get( param );
-  for ( i=0 ; i<len ; i++ )
-    cc_write( CC_PATABLE, param[i]);
+  cc_write_burst( CC_SPI_BURST, CC_PATABLE, param, len );
+
+  cc_spi_release();
 
   cc_enter_rx_mode();
+
+  init_time = (uint32_t)( esp_timer_get_time() - start );
+  ESP_LOGI( TAG, "RX mode %lu uS after init", init_time );
 }
 
@@ -0,0 +1,97 @@
+/********************************************************************
+ * ramses_esp
+ * cc_cmd.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * CC1101 Commands
+ *
+ */
+#include "cmd.h"
+#include "cc_cmd.h"
+#include "cc1101.h"
+
+/*********************************************************
+ * SPI transaction statistics
+ */
+static char const *cc_spi_op_text( enum cc_spi_op op ) {
+  static char const * const op_text[CC_SPI_OP_MAX] = {
+    #define CC_SPI_OP( _e,_t ) _t,
+    CC_SPI_OP_LIST
+    #undef CC_SPI_OP
+  };
+
+  char const *text = "Unknown";
+  if( op<CC_SPI_OP_MAX )
+    text = op_text[op];
+
+  return text;
+}
+
+static int cc_cmd_spi( int argc, char **argv ) {
+  enum cc_spi_op op;
+
+  if( argc>1 && !strcmp( argv[1], "reset" ) ) {
+    cc_spi_stats_reset();
+    return 0;
+  }
+
+  printf("# SPI %d kHz\n", CONFIG_CC_SPI_CLOCK_KHZ );
+  printf("# %-8s %10s %8s %8s\n", "op", "count", "avg uS", "max uS" );
+  for( op=0 ; op<CC_SPI_OP_MAX ; op++ ) {
+    struct cc_spi_stats const *stats = cc_spi_stats( op );
+    uint32_t avg = stats->count ? stats->total / stats->count : 0;
+    printf("# %-8s %10lu %8lu %8lu\n", cc_spi_op_text(op), stats->count, avg, stats->max );
+  }
+  printf("# %-8s %10lu\n", "skipped", cc_shadow_hits() );
+
+  return 0;
+}
+
+/*********************************************************
+ * Startup time
+ */
+static int cc_cmd_init( int argc, char **argv ) {
+  printf("# cc_init to RX %lu uS\n", cc_init_time() );
+
+  return 0;
+}
+
+/*********************************************************
+ * Top Level command
+ */
+
+static esp_console_cmd_t const cc_cmds[] = {
+  {
+    .command = "spi",
+    .help = "Show SPI transaction times, 'spi reset' to clear",
+    .hint = NULL,
+    .func = &cc_cmd_spi,
+  },
+  {
+    .command = "init",
+    .help = "Show time from initialisation to RX mode",
+    .hint = NULL,
+    .func = &cc_cmd_init,
+  },
+  // List termination
+  { NULL_COMMAND }
+};
+
+static int cc_cmd( int argc, char **argv ) {
+  return cmd_menu( argc, argv, cc_cmds, argv[0] );
+}
+
+void cc_register(void) {
+  const esp_console_cmd_t cc[] = {
+    {
+      .command = "cc",
+      .help = "CC1101 commands, enter 'cc' for list",
+	  .hint = NULL,
+	  .func = &cc_cmd,
+    },
+	{ NULL_COMMAND }
+  };
+
+  cmd_menu_register( cc );
+}
@@ -0,0 +1,41 @@
+/********************************************************************
+ * ramses_esp
+ * cc_cmd.h
+ *
+ * (C) 2025 Peter Price
+ *
+ * CC1101 Commands
+ *
+ */
+#ifndef _CC_CMD_H_
+#define _CC_CMD_H_
+
+#include <stdint.h>
+
+#define CC_SPI_OP_LIST \
+  CC_SPI_OP( CC_SPI_READ,   "read" ) \
+  CC_SPI_OP( CC_SPI_WRITE,  "write" ) \
+  CC_SPI_OP( CC_SPI_STROBE, "strobe" ) \
+  CC_SPI_OP( CC_SPI_FIFO,   "fifo" ) \
+  CC_SPI_OP( CC_SPI_BURST,  "burst" ) \
+
+#define CC_SPI_OP( _e, _t ) _e,
+enum cc_spi_op {
+  CC_SPI_OP_LIST
+  CC_SPI_OP_MAX
+};
+#undef CC_SPI_OP
+
+struct cc_spi_stats {
+  uint32_t count;
+  uint32_t total;   // uS
+  uint32_t max;     // uS
+};
+
+extern struct cc_spi_stats const *cc_spi_stats( enum cc_spi_op op );
+extern void cc_spi_stats_reset( void );
+
+extern uint32_t cc_init_time( void );
+extern uint32_t cc_shadow_hits( void );
+
+#endif // _CC_CMD_H_
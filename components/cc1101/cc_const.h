@@ -82,6 +82,7 @@
 #define CC_FIFO      0x3F
 
 #define CC_PA_MAX      8
+#define CC_FIFO_SIZE  64
 
 // Burst mode registers
 #define CC_PARTNUM        ( CC_SRES     | CC_BURST )
@@ -23,8 +23,11 @@ extern void cc_enter_rx_mode(void);
 extern void cc_enter_tx_mode(void);
 
 extern uint8_t cc_write_fifo(uint8_t b);
+extern uint8_t cc_write_fifo_burst( uint8_t const *data, uint8_t n );
 extern void cc_fifo_end(void);
 
+extern void cc_register(void);
+
 extern void cc_init(void);
 extern void cc_work(void);
 
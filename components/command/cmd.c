@@ -72,6 +72,19 @@ static void console_init( char *line, int len ) {
   while( usb_serial_jtag_read_bytes( line, len, 0 ) ){}
 }
 
+// Raw input handler, NULL while reading command lines
+static cmd_input_func cmd_input;
+
+void cmd_set_input( cmd_input_func func ) {
+  cmd_input = func;
+}
+
+static void console_read_raw( char *buff, int len ) {
+  int n = usb_serial_jtag_read_bytes( buff, len, 10/portTICK_PERIOD_MS );
+  if( n>0 && cmd_input )
+    ( cmd_input )( buff, n );
+}
+
 static int console_readline( char *line, int len ) {
   int n = 0;
 
@@ -186,6 +199,11 @@ void cmd_work( struct cmd_data *data ) {
     int ret;
     esp_err_t err;
 
+    if( cmd_input ) {
+      console_read_raw( data->line, sizeof(data->line) );
+      continue;
+    }
+
     console_readline( data->line, sizeof(data->line) );
 
     err = esp_console_run( data->line, &ret );
@@ -23,6 +23,10 @@ extern void cmd_menu_register( esp_console_cmd_t const *cmd );
 
 extern esp_err_t cmd_run( char const *cmdline, int *cmd_ret );
 
+// Pass console input to <func> instead of the command line, NULL to restore
+typedef void (*cmd_input_func)( char const *bytes, int n );
+extern void cmd_set_input( cmd_input_func func );
+
 struct cmd_data;
 extern struct cmd_data *cmd_init(void);
 extern void cmd_work( struct cmd_data *data );
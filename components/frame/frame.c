@@ -20,6 +20,7 @@
 #include <sys/time.h>
 
 #include <driver/uart.h>
+#include <esp_timer.h>
 
 static const char * TAG = "FRM";
 #include "esp_log.h"
@@ -28,22 +29,54 @@ static const char * TAG = "FRM";
 #include "ramses_led.h"
 #include "cc1101.h"
 #include "uart.h"
+#include "manchester.h"
 #include "frame.h"
+#include "frame_cmd.h"
 #include "message.h"
 
 #include "ramses_debug.h"
 #define DEBUG_FRAME(_i)   //do{if(_i)DEBUG1_ON;else DEBUG1_OFF;}while(0)
 
-static uint64_t frm_time(void) {
-  uint64_t ts;
-  struct timeval tv;
-  gettimeofday( &tv, NULL );
-  ts = tv.tv_sec * 1000LL + (tv.tv_usec / 1000LL);
-  return ts;
+/*
+ * All frame timing uses the monotonic esp_timer clock in uS.
+ * gettimeofday() jumps when SNTP sets the clock.
+ */
+static int64_t frm_time(void) {
+  return esp_timer_get_time();
 }
 
-static uint64_t last_frm;
-static uint64_t last_cal;
+#define FRM_MS  1000LL
+#define FRM_SEC 1000000LL
+
+static int64_t last_frm;
+static int64_t last_cal;
+
+// Duration of one UART byte, start + 8 data + stop bits
+#define FRM_BYTE_TIME ( 10 * FRM_SEC / RADIO_BAUDRATE )
+
+/***********************************************************************************
+** RX/TX turnaround measurement
+*/
+static struct frame_turnaround turnaround[FRM_TURNAROUND_MAX];
+
+static void frame_turnaround_update( enum frame_turnaround_dir dir, int64_t start ) {
+  struct frame_turnaround *t = turnaround + dir;
+  uint32_t time = (uint32_t)( esp_timer_get_time() - start );
+
+  t->last = time;
+  t->total += time;
+  if( !t->count || time<t->min ) t->min = time;
+  if( time>t->max ) t->max = time;
+  t->count++;
+}
+
+struct frame_turnaround const *frame_turnaround( enum frame_turnaround_dir dir ) {
+  return ( dir<FRM_TURNAROUND_MAX ) ? turnaround+dir : NULL ;
+}
+
+void frame_turnaround_reset( void ) {
+  memset( turnaround, 0, sizeof(turnaround) );
+}
 
 /***********************************************************************************
 ** Frame state machine
@@ -64,66 +97,6 @@ static void frame_reset(void) {
   memset( &frame, 0, sizeof(frame) );
 }
 
-/*******************************************************
-* Manchester Encoding
-*
-* The [Evo Message] is encoded in the bitstream with a
-* Manchester encoding.  This is the only part of the
-* complete packet encoded in this way so we cannot
-* use the built in function of the CC1101
-*
-* While the bitstream is interpreted as a Big-endian stream
-* the manchester codes inserted in the stream are little-endian
-*
-* The Manchester data here is designed to correspond with the
-* Big-endian byte stream seen in the bitstream.
-*
-********
-* NOTE *
-********
-* The manchester decode process converts the data from
-*     8 bit little-endian to 4 bit big-endian
-* The manchester encode process converts the data from
-*     4 bit big-endian to 8 bit little-endian
-*
-* Since only a small subset of 8-bit values are actually allowed in
-* the bitstream rogue values can be used to identify some errors in
-* the bitstream.
-*
-*/
-
-// Convert big-endian 4 bits to little-endian byte
-static uint8_t const man_encode[16] = {
-  0xAA, 0xA9, 0xA6, 0xA5,  0x9A, 0x99, 0x96, 0x95,
-  0x6A, 0x69, 0x66, 0x65,  0x5A, 0x59, 0x56, 0x55
-};
-#define MAN_ENCODE(_i) man_encode[_i]
-
-// Convert little-endian 4 bits to 2-bit big endian
-static uint8_t const man_decode[16] = {
-  0xF, 0xF, 0xF, 0xF, 0xF, 0x3, 0x2, 0xF,
-  0xF, 0x1, 0x0, 0xF, 0xF, 0xF, 0xF, 0xF
-};
-#define MAN_DECODE(_i) man_decode[_i]
-
-static inline int manchester_code_valid( uint8_t code ) {
- return ( MAN_DECODE( (code>>4)&0xF )!=0xF ) && ( MAN_DECODE( (code   )&0xF )!=0xF ) ;
-}
-
-static inline uint8_t manchester_decode( uint8_t byte ) {
-  uint8_t decoded;
-
-  decoded  = MAN_DECODE( ( byte    ) & 0xF );
-  decoded |= MAN_DECODE( ( byte>>4 ) & 0xF )<<2;
-
-  return decoded;
-}
-
-static inline uint8_t manchester_encode( uint8_t value ) {
-  return MAN_ENCODE(value & 0xF )
-  ;
-}
-
 /*******************************************************
 ** RAMSES Frame
 ** A frame consists of <training><header><message><trailer><training>
@@ -167,77 +140,148 @@ static struct rx_frame {
   uint8_t count;
   uint8_t msgErr;
   uint8_t msgByte;
+
+  int64_t endTime;
 } rxFrm;
 
+// Time the last byte of the current block of UART data arrived
+static int64_t rx_block_time;
+
+// Estimate when the byte before <b> arrived in a block ending at <end>
+static inline int64_t frame_rx_time( uint8_t const *b, uint8_t const *end ) {
+  return rx_block_time - (int64_t)( end - b ) * FRM_BYTE_TIME;
+}
+
 static void frame_rx_reset(void) {
   memset( &rxFrm, 0, sizeof(rxFrm) );
 }
 
-void frame_rx_byte( uint8_t b ) {
-  switch( rxFrm.state ) {
-  case FRM_RX_OFF:
-	break;
-
-  case FRM_RX_IDLE:
-  case FRM_RX_SYNCH: // wait for the <header>
-    rxFrm.syncBuffer <<= 8;
-    rxFrm.syncBuffer |= b;
-    if( rxFrm.syncBuffer==syncWord ) {
-      ESP_LOGI( TAG, "SYNCH" );
-      rxFrm.raw = msg_rx_start();
-      if( rxFrm.raw ) {
-        rxFrm.nRaw = rxFrm.raw[0];
-	    rxFrm.state  = FRM_RX_MESSAGE;
-        DEBUG_FRAME(1);
-        led_on(LED_RX);
-	  }
-	}
-    break;
+static void frame_rx_synch( int64_t time ) {
+  ESP_LOGI( TAG, "SYNCH" );
+  rxFrm.raw = msg_rx_start( time );
+  if( rxFrm.raw ) {
+    rxFrm.nRaw = rxFrm.raw[0];
+    rxFrm.state  = FRM_RX_MESSAGE;
+    DEBUG_FRAME(1);
+    led_on(LED_RX);
+  }
+}
 
-  case FRM_RX_MESSAGE:
-    if( b == ramses_tlr[0] ) {
-	  rxFrm.state = FRM_RX_DONE;
-      ESP_LOGI( TAG, "DONE raw=%d msg=%d",rxFrm.nBytes, 1 );
+// wait for the <header>
+static uint8_t const *frame_rx_idle( uint8_t const *b, uint8_t const *end ) {
+  uint32_t syncBuffer = rxFrm.syncBuffer;
+
+  while( b < end ) {
+    syncBuffer = ( syncBuffer<<8 ) | *(b++);
+    if( syncBuffer==syncWord ) {
+      frame_rx_synch( frame_rx_time( b, end ) );
+      if( rxFrm.state==FRM_RX_MESSAGE )
+        break;
+    }
+  }
+
+  rxFrm.syncBuffer = syncBuffer;
+
+  return b;
+}
+
+static uint8_t const *frame_rx_message( uint8_t const *b, uint8_t const *end ) {
+  uint8_t nBytes  = rxFrm.nBytes;
+  uint8_t count   = rxFrm.count;
+  uint8_t msgByte = rxFrm.msgByte;
+
+  while( b < end ) {
+    uint8_t byte = *(b++);
+    uint8_t nibble;
+
+    if( byte == ramses_tlr[0] ) {
+      rxFrm.state = FRM_RX_DONE;
+      ESP_LOGI( TAG, "DONE raw=%d msg=%d",nBytes, 1 );
+      break;
+    }
+
+    rxFrm.raw[nBytes++] = byte;
+
+    nibble = MAN_RX( byte );
+    if( nibble==MAN_INVALID ) {
+      rxFrm.state = FRM_RX_ABORT;
+      rxFrm.msgErr = MSG_MANC_ERR;
+      ESP_LOGE( TAG, "raw[%d]=%02x (MC)",nBytes-1, byte );
     } else {
-      ESP_LOGD( TAG, "raw[%d]=%02x",rxFrm.nBytes, b );
-      rxFrm.raw[rxFrm.nBytes++] = b;
-
-      if( !manchester_code_valid( b ) ) {
-        rxFrm.state = FRM_RX_ABORT;
-        rxFrm.msgErr = MSG_MANC_ERR;
-        ESP_LOGE( TAG, "raw[%d]=%02x (MC)",rxFrm.nBytes-1, b );
-      } else {
-        rxFrm.msgByte <<= 4;
-        rxFrm.msgByte |= manchester_decode( b );
-        rxFrm.count = 1- rxFrm.count;
-
-        if( !rxFrm.count ) {
-          rxFrm.msgErr = msg_rx_byte( rxFrm.msgByte );
-          if( rxFrm.msgErr != MSG_OK ) {
-            ESP_LOGE( TAG, "raw[%d]=%02x (MSG)",rxFrm.nBytes-1, b );
-            rxFrm.state = FRM_RX_ABORT;
-          }
+      msgByte <<= 4;
+      msgByte |= nibble;
+      count = 1 - count;
+
+      if( !count ) {
+        rxFrm.msgErr = msg_rx_byte( msgByte );
+        if( rxFrm.msgErr != MSG_OK ) {
+          ESP_LOGE( TAG, "raw[%d]=%02x (MSG)",nBytes-1, byte );
+          rxFrm.state = FRM_RX_ABORT;
         }
       }
+    }
 
-      // Protect raw data buffer
-      if( rxFrm.nBytes >= rxFrm.nRaw ) {
-        rxFrm.state = FRM_RX_ABORT;
-        rxFrm.msgErr = MSG_OVERRUN_ERR;
-      }
+    // Protect raw data buffer
+    if( nBytes >= rxFrm.nRaw ) {
+      rxFrm.state = FRM_RX_ABORT;
+      rxFrm.msgErr = MSG_OVERRUN_ERR;
     }
-    break;
 
-  case FRM_RX_DONE:
-  case FRM_RX_ABORT:
-    break;
+    if( rxFrm.state != FRM_RX_MESSAGE )
+      break;
+  }
+
+  rxFrm.nBytes  = nBytes;
+  rxFrm.count   = count;
+  rxFrm.msgByte = msgByte;
+
+  if( rxFrm.state != FRM_RX_MESSAGE )
+    rxFrm.endTime = frame_rx_time( b, end );
+
+  return b;
+}
+
+/*
+ * Process a block of UART data
+ *
+ * Noise and inter-frame data is consumed by a simple scan for the
+ * <header> and message data by a single decode loop.
+ * Once a frame is complete any remaining data is discarded until
+ * frame_work() has processed the frame, as frame_rx_byte() did.
+ */
+void frame_rx_bytes( uint8_t const *bytes, size_t n ) {
+  uint8_t const *end = bytes + n;
+
+  rx_block_time = frm_time();
+
+  while( bytes < end ) {
+    switch( rxFrm.state ) {
+    case FRM_RX_IDLE:
+    case FRM_RX_SYNCH:
+      bytes = frame_rx_idle( bytes, end );
+      break;
+
+    case FRM_RX_MESSAGE:
+      bytes = frame_rx_message( bytes, end );
+      break;
+
+    case FRM_RX_OFF:
+    case FRM_RX_DONE:
+    case FRM_RX_ABORT:
+      return;
+    }
   }
 }
 
+void frame_rx_byte( uint8_t b ) {
+  frame_rx_bytes( &b, 1 );
+}
+
 static void frame_rx_done(void) {
   // Reset rxFrm as quickly as possible after collision can pick up new frame header
   uint8_t nBytes = rxFrm.nBytes;
   uint8_t msgErr = rxFrm.msgErr;
+  int64_t endTime = rxFrm.endTime;
   uint8_t rssi;
 
   DEBUG_FRAME(0);
@@ -253,7 +297,7 @@ static void frame_rx_done(void) {
   msg_rx_rssi( rssi );
   msg_rx_end(nBytes,msgErr);
 
-  last_frm = frm_time();
+  last_frm = endTime;
 
   DEBUG_FRAME(0);
   led_off(LED_RX);
@@ -261,32 +305,21 @@ static void frame_rx_done(void) {
 
 /***************************************************************************
 ****************************************************************************
-** TX HW interface - cc1101 FIFO
+** TX bitstream
 ****************************************************************************
 ****************************************************************************/
 
 /*****************************************************************
-* NOTE: The following shift_register structure is sensitive to
-*       the endianness used by the MCU.  It may be necessary to
-*       swap the order of .bits and .data
+* The cc1101 sends the FIFO contents as a synchronous bitstream.
+* The RAMSES receivers expect an asynchronous serial stream so
+* each byte is framed like a UART character, LSB first, with a
+* stop bit and a start bit.
 *
-* The desired behaviour is that when .reg is left shifted the
-* msb of .bits becomes the lsb of .data
+* tx_symbol[] holds the 10 bit on-air pattern for each byte
+*   <stop><start><b0>..<b7>
+* in the order it is shifted into the bitstream.
 */
-static union shift_register {
-  uint16_t reg;
-  struct {
-#if __BYTE_ORDER__ ==__ORDER_LITTLE_ENDIAN__
-    uint8_t bits;
-    uint8_t data;
-#endif
-#if __BYTE_ORDER__ ==__ORDER_BIG_ENDIAN__
-    uint8_t data;
-    uint8_t bits;
-#endif
-  };
-} tx;
-static uint8_t txBits;   // Number of valid bits in shift register
+static uint16_t tx_symbol[256];
 
 static uint8_t swap4( uint8_t in ) {
   static uint8_t out[16] = {
@@ -306,50 +339,58 @@ static uint8_t swap8( uint8_t in ) {
   return out;
 }
 
-static uint8_t tx_data(void) {
-   return cc_write_fifo( tx.data );
+static void tx_symbol_init( void ) {
+  uint16_t byte;
+
+  for( byte=0 ; byte<256 ; byte++ )
+    tx_symbol[byte] = 0x200 | swap8( byte );
 }
 
-static inline void insert_p(void)  { tx.data <<= 1 ; tx.data |= 0x01; }
-static inline void insert_s(void)  { tx.data <<= 1 ; }
-static inline void insert_ps(void) { insert_p(); insert_s(); }
-static inline void send( uint8_t n ) { tx.reg <<= n ; }
+struct tx_bitstream {
+  uint8_t *octet;
+  uint16_t nOctets;
 
-static uint8_t tx_byte( uint8_t byte ) { // convert byte to octets
-  uint8_t space = 15;
+  uint32_t reg;	   // Shift register
+  uint8_t nBits;   // Number of valid bits in shift register
+};
 
-  tx.bits = swap8(byte);
+static void tx_render( struct tx_bitstream *tx, uint8_t const *data, uint8_t n ) {
+  while( n-- ) {
+    tx->reg = ( tx->reg<<10 ) | tx_symbol[ *(data++) ];
+    tx->nBits += 10;
 
-  // For each 4 bytes of data we send 5 octets of bitstream
-  // so there is one case which generates two octets
-  switch( txBits )
-  {
-  case 0: insert_ps(); send(6); space = tx_data(); send(2); txBits=2; break;
-  case 2: insert_ps(); send(4); space = tx_data(); send(4); txBits=4; break;
-  case 4: insert_ps(); send(2); space = tx_data(); send(6); // Fall through
-  case 6: insert_ps();          space = tx_data();          txBits=8; break;
-  case 8:              send(8); space = tx_data();          txBits=0; break;
+    while( tx->nBits >= 8 ) {
+      tx->nBits -= 8;
+      tx->octet[ tx->nOctets++ ] = (uint8_t)( tx->reg >> tx->nBits );
+    }
   }
-
-  return space;
 }
 
-static void tx_flush( void ) {
+static void tx_render_end( struct tx_bitstream *tx ) {
   // flush outstanding bits
-  if( txBits ) {
-    send(8-txBits);
-    tx_data();
+  if( tx->nBits ) {
+    tx->octet[ tx->nOctets++ ] = (uint8_t)( tx->reg << ( 8-tx->nBits ) );
+    tx->nBits = 0;
   }
 
   // Leave in SPACE condition
-  tx.data = 0xFF;
-  tx_data();
+  tx->octet[ tx->nOctets++ ] = 0xFF;
 }
 
-//-----------------------------------------------------------------
-// TX FIFO
+/***************************************************************************
+****************************************************************************
+** TX HW interface - cc1101 FIFO
+****************************************************************************
+****************************************************************************/
+
+static uint8_t frame_tx_block( void );
+static void frame_tx_end( void );
 
+// GDO0_ISR disables itself until the event has been handled
+// so there is never more than one event outstanding
+#define TX_ISR_QUEUE_LEN 1
 static QueueHandle_t tx_isr_queue;
+static int64_t tx_isr_time;
 
 static enum tx_fifo_state {
   TX_FIFO_FILL,
@@ -358,63 +399,42 @@ static enum tx_fifo_state {
 
 static void tx_fifo_stop(void) {
   gpio_isr_handler_remove( CONFIG_CC_GDO0_GPIO );
-  xQueueReset( tx_isr_queue );
 }
 
 static void tx_fifo_wait(void) {
-  uint8_t data;
   tx_fifo_stop();
-  frame_tx_byte( &data );
+  frame_tx_end();
 }
 
-static uint8_t tx_fifo_send_block(void) {
-  uint8_t done;
-
-  uint8_t count;
-  uint8_t block = 4;
-
-  do {
-    uint8_t data;
-    done = frame_tx_byte( &data );
-    count = tx_byte( data );
-    block--;
-  } while( block && !done && count>4 );
+static void tx_fifo_end(void) {
+  cc_fifo_end();
+  tx_state = TX_FIFO_WAIT;
 
-  return done;
+  // Switch to rising edge to detect FIFO empty
+  gpio_set_intr_type( CONFIG_CC_GDO0_GPIO, GPIO_INTR_POSEDGE );
 }
 
 static void tx_fifo_prime( void ) {
   // Not clear why but have to send a zero byte to start TX correctly
   cc_write_fifo( 0x00 );
 
-  // Now send a BREAK condition
-  cc_write_fifo( 0xFF );
-  cc_write_fifo( 0x00 );
-  cc_write_fifo( 0x00 );
-
   // So we can see an interrupt when it falls below threshold
   // send sufficient data to fill FIFO above threshold
-  txBits = 0;
-  while( !gpio_get_level( CONFIG_CC_GDO0_GPIO ) )
-    tx_fifo_send_block();
+  if( frame_tx_block() )
+    tx_fifo_end();
 }
 
 static void tx_fifo_fill(void) {
-  uint8_t done = tx_fifo_send_block();
+  uint8_t done = frame_tx_block();
 
-  if( done ) {
-    tx_flush();
-    cc_fifo_end();
-    tx_state = TX_FIFO_WAIT;
-
-    // Switch to rising edge to detect FIFO empty
-    gpio_set_intr_type( CONFIG_CC_GDO0_GPIO, GPIO_INTR_POSEDGE );
-   }
+  if( done )
+    tx_fifo_end();
 }
 
 //---------------------------------------------------------------------------------
 
 static void IRAM_ATTR GDO0_ISR(void *args) {
+  tx_isr_time = esp_timer_get_time();
   gpio_intr_disable( CONFIG_CC_GDO0_GPIO );
   xQueueSendFromISR( tx_isr_queue, NULL, NULL );
 }
@@ -425,7 +445,7 @@ static void tx_fifo_init(void) {
   gpio_pulldown_en( CONFIG_CC_GDO0_GPIO );
   gpio_pullup_dis( CONFIG_CC_GDO0_GPIO );
 
-  tx_isr_queue = xQueueCreate( 32, 0 );
+  tx_isr_queue = xQueueCreate( TX_ISR_QUEUE_LEN, 0 );
   gpio_install_isr_service(0);
 }
 
@@ -433,14 +453,15 @@ static void tx_fifo_start(void) {
   // Falling edge for FIFO low
   gpio_set_intr_type( CONFIG_CC_GDO0_GPIO, GPIO_INTR_NEGEDGE );
 
-  tx_fifo_prime();
   tx_state = TX_FIFO_FILL;
+  tx_fifo_prime();
 
   gpio_isr_handler_add( CONFIG_CC_GDO0_GPIO, GDO0_ISR,  NULL );
 }
 
 static void tx_fifo_work(void) {
-  if( xQueueReceive( tx_isr_queue, NULL, 0 )){
+  // A stray event after TX has finished is simply discarded
+  if( xQueueReceive( tx_isr_queue, NULL, 0 ) && frame.state==FRM_TX ){
     DEBUG_FRAME(0);
     led_off(LED_TX);
     switch(tx_state) {
@@ -463,33 +484,18 @@ static void tx_fifo_work(void) {
 **   <message> = < manchester encoded pairs of bytes >
 **   <suffix>  = <trailer><training>
 **
+** The complete bitstream is built by frame_tx_start() before TX is enabled
+** so the FIFO only has to be refilled with the pre-built octets.
 */
 
 enum frame_tx_states {
   FRM_TX_OFF,
   FRM_TX_READY,
   FRM_TX_IDLE,
-  FRM_TX_PREFIX,
-  FRM_TX_MESSAGE,
-  FRM_TX_SUFFIX,
+  FRM_TX_DATA,
   FRM_TX_DONE
 };
 
-static struct frame_tx {
-  uint8_t state;
-
-  uint8_t nBytes;
-  uint8_t nRaw;
-  uint8_t *raw;
-
-  uint8_t count;
-  uint8_t msgByte;
-} txFrm;
-
-static void frame_tx_reset(void) {
-  memset( &txFrm, 0, sizeof(txFrm) );
-}
-
 static uint8_t tx_prefix[] = {
   0x55, 0x55, 0x55, 0x55, 0x55,   // Pre-amble
   0xFF, 0x00,                     // Sync Word
@@ -501,11 +507,44 @@ static uint8_t tx_suffix[] = {
   0x55,                           // Training
 };
 
+static uint8_t tx_break[] = {
+  0xFF, 0x00, 0x00                // BREAK condition
+};
+
+// Every byte becomes 10 bits, plus final partial octet and SPACE condition
+#define TX_MAX_RAW   162
+#define TX_MAX_BYTES ( sizeof(tx_prefix) + TX_MAX_RAW + sizeof(tx_suffix) )
+#define TX_MAX_OCTET ( sizeof(tx_break) + ( TX_MAX_BYTES*10 + 7 ) / 8 + 1 )
+
+// Maximum octets written to FIFO for each GDO0 interrupt
+// GDO0 falls when there are fewer than 5 bytes in the 64 byte FIFO
+#define TX_FIFO_BLOCK 56
+
+// The sync word has been sent when the priming byte, <break> and <prefix> have gone
+#define TX_SYNC_TIME ( ( 1 + sizeof(tx_break) + sizeof(tx_prefix) ) * FRM_BYTE_TIME )
+
+static struct frame_tx {
+  uint8_t state;
+  int64_t time;
+
+  uint16_t count;
+  uint16_t nOctets;
+  uint8_t octet[TX_MAX_OCTET];
+} txFrm;
+
+static void frame_tx_reset(void) {
+  memset( &txFrm, 0, sizeof(txFrm) );
+}
+
 void frame_tx_start( uint8_t *raw, uint8_t nRaw ) {
+  struct tx_bitstream tx = { .octet = txFrm.octet };
   uint8_t i, done, byte;
 
+  if( nRaw > TX_MAX_RAW )
+    nRaw = TX_MAX_RAW;
+
   // Encode raw frame
-  for( i=0 ; i<nRaw+1 ; i+=2 ) {
+  for( i=0 ; i+1<nRaw ; i+=2 ) {
   	byte = msg_tx_byte(&done);
 	if( done ) break;
 	
@@ -513,65 +552,47 @@ void frame_tx_start( uint8_t *raw, uint8_t nRaw ) {
 	raw[ i+1 ] = manchester_encode( byte      );
   }
 
-  txFrm.nBytes = i;
-  txFrm.raw = raw;
-  txFrm.nRaw = nRaw;
-	
-  txFrm.state = FRM_TX_READY;
-}
+  msg_tx_end( i );
 
-uint8_t frame_tx_byte(uint8_t *byte) {
-  uint8_t done = 0;
+  // Build bitstream
+  memcpy( tx.octet, tx_break, sizeof(tx_break) );
+  tx.nOctets = sizeof(tx_break);
 
-  switch( txFrm.state ) {
-  case FRM_TX_IDLE:
-    txFrm.state = FRM_TX_PREFIX;
-    // Fall through
+  tx_render( &tx, tx_prefix, sizeof(tx_prefix) );
+  tx_render( &tx, raw, i );
+  tx_render( &tx, tx_suffix, sizeof(tx_suffix) );
+  tx_render_end( &tx );
 
-  case FRM_TX_PREFIX:
-    if( txFrm.count < sizeof(tx_prefix) ) {
-      (*byte) = tx_prefix[txFrm.count++];
-      break;
-    }
-    txFrm.count = 0;
-    txFrm.state = FRM_TX_MESSAGE;
-    // Fall through
-
-  case FRM_TX_MESSAGE:
-    if( txFrm.count < txFrm.nBytes ) {
-      (*byte) = txFrm.raw[ txFrm.count++ ];
-	  break;
-    } 
-
-    msg_tx_end( txFrm.nBytes );
-
-    txFrm.count = 0;
-    txFrm.state = FRM_TX_SUFFIX;
-    // Fall through
-
-  case FRM_TX_SUFFIX:
-    if( txFrm.count < sizeof(tx_suffix) ) {
-      (*byte) = tx_suffix[txFrm.count++];
-      if( txFrm.count == sizeof(tx_suffix) )
-        done = 1;
-      break;
-    }
-    last_frm = frm_time();
+  txFrm.nOctets = tx.nOctets;
+  txFrm.count = 0;
 
-    txFrm.count = 0;
-    txFrm.state = FRM_TX_DONE;
-    // Fall through
+  txFrm.state = FRM_TX_READY;
+}
 
-  case FRM_TX_DONE:
-  	done = 1;
-    break;
+// Copy the next block of the bitstream to the FIFO
+static uint8_t frame_tx_block(void) {
+  uint16_t block = txFrm.nOctets - txFrm.count;
+
+  if( block > TX_FIFO_BLOCK )
+    block = TX_FIFO_BLOCK;
+
+  txFrm.state = FRM_TX_DATA;
+  if( block ) {
+    cc_write_fifo_burst( txFrm.octet+txFrm.count, block );
+    txFrm.count += block;
   }
 
-  return done;
+  return ( txFrm.count >= txFrm.nOctets );
+}
+
+// Called when the FIFO is empty
+static void frame_tx_end(void) {
+  last_frm = frm_time();
+  txFrm.state = FRM_TX_DONE;
 }
 
 static void frame_tx_done(void) {
-  msg_tx_done();
+  msg_tx_done( txFrm.time );
   frame_tx_reset();
 }
 
@@ -600,9 +621,89 @@ static void frame_tx_enable(void) {
   // make sure we switch back to RX after TX
   rxFrm.state = FRM_RX_OFF;
 
+  txFrm.time = frm_time() + TX_SYNC_TIME;
   tx_fifo_start();
 }
 
+/***************************************************************************
+** Radio task events
+**
+** The radio task blocks on a single queue set until there is work to do.
+**   UART RX data
+**   GDO0 TX FIFO interrupts
+**   New messages in the TX list, see frame_wake()
+** A timeout covers the TX holdoff and calibration deadlines.
+*/
+#define FRM_WAKE_QUEUE_LEN 1
+static QueueSetHandle_t frm_events;
+static QueueHandle_t frm_wake;
+
+void frame_wake(void) {
+  if( frm_wake )
+    xQueueSend( frm_wake, NULL, 0 );
+}
+
+static void frame_events_init(void) {
+  frm_events = xQueueCreateSet( UART_EVENT_QUEUE_LEN + TX_ISR_QUEUE_LEN + FRM_WAKE_QUEUE_LEN );
+  frm_wake = xQueueCreate( FRM_WAKE_QUEUE_LEN, 0 );
+  xQueueAddToSet( frm_wake, frm_events );
+}
+
+// How long can we sleep before there's something to do
+static TickType_t frame_timeout(void) {
+  int64_t now = frm_time();
+  int64_t next = last_cal + CONFIG_FRM_MAX_CAL_INTERVAL*FRM_SEC + 1;
+  int64_t holdoff;
+
+  switch( frame.state ) {
+  case FRM_OFF:
+    return portMAX_DELAY;
+
+  case FRM_RX:
+    if( rxFrm.state==FRM_RX_OFF || rxFrm.state>=FRM_RX_DONE )
+      return 0;
+
+    // Nothing else can start until the frame ends, UART events will wake us
+    if( rxFrm.state==FRM_RX_MESSAGE )
+      return portMAX_DELAY;
+
+    // frame_work() holds off both TX and calibration after the last frame
+    holdoff = last_frm + CONFIG_FRM_MIN_TX_DELAY*FRM_MS + 1;
+    if( txFrm.state==FRM_TX_READY || next < holdoff )
+      next = holdoff;
+    break;
+
+  case FRM_TX:
+    // GDO0 will wake us, calibration deadline is only a backstop
+    if( txFrm.state>=FRM_TX_DONE )
+      return 0;
+    break;
+
+  default:
+    return 0;
+  }
+
+  if( next <= now )
+    return 0;
+
+  return pdMS_TO_TICKS( ( next - now + FRM_MS-1 ) / FRM_MS ) + 1;
+}
+
+static void frame_event_work(void) {
+  QueueSetMemberHandle_t event = xQueueSelectFromSet( frm_events, frame_timeout() );
+
+  if( !event )
+    return;
+
+  // Every event selected must be removed from its queue
+  if( event==frm_wake )
+    xQueueReceive( frm_wake, NULL, 0 );
+  else if( event==tx_isr_queue )
+    tx_fifo_work();
+  else
+    uart_work( event );
+}
+
 void frame_disable(void) {
   uart_disable();
   cc_enter_idle_mode();
@@ -622,18 +723,21 @@ void frame_init(void) {
   for( i=0 ; i<sizeof(ramses_hdr) ; i++ )
     syncWord = ( syncWord<<8 ) | ramses_hdr[i];
 
+  tx_symbol_init();
   frame_reset();
 
   cc_init();
-  uart_init();
+  frame_events_init();
+  uart_init( frm_events );
   tx_fifo_init();
+  xQueueAddToSet( tx_isr_queue, frm_events );
 
   frame.state = FRM_IDLE;
 }
 
 
 void frame_work(void) {
-  uart_work();
+  frame_event_work();
 
   switch( frame.state ) {
   case FRM_IDLE:
@@ -657,15 +761,17 @@ void frame_work(void) {
     }
 
     if( rxFrm.state<FRM_RX_MESSAGE ) { // RX not active
-   	  uint64_t now = frm_time();
-      if( ( now - last_frm ) > CONFIG_FRM_MIN_TX_DELAY ) {
+   	  int64_t now = frm_time();
+      if( ( now - last_frm ) > CONFIG_FRM_MIN_TX_DELAY*FRM_MS ) {
         if( txFrm.state==FRM_TX_READY ) {
+          int64_t start = esp_timer_get_time();
           led_on(LED_TX);
           frame_tx_enable();
+          frame_turnaround_update( FRM_RX_TO_TX, start );
           break;
         }
 
-        if ( ( now - last_cal ) > CONFIG_FRM_MAX_CAL_INTERVAL*1000 ) {
+        if ( ( now - last_cal ) > CONFIG_FRM_MAX_CAL_INTERVAL*FRM_SEC ) {
           // Force a recalibration if we haven't done one for a while
           frame_rx_enable();
           break;
@@ -684,10 +790,9 @@ void frame_work(void) {
       led_off(LED_TX);
       frame_tx_done();
       frame_rx_enable();
+      frame_turnaround_update( FRM_TX_TO_RX, tx_isr_time );
       break;
     }
-
-    tx_fifo_work();
     break;
   }
 
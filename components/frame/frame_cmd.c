@@ -0,0 +1,122 @@
+/********************************************************************
+ * ramses_esp
+ * frame_cmd.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Frame Commands
+ *
+ */
+#include <stdlib.h>
+
+#include "cmd.h"
+#include "frame_cmd.h"
+#include "frame.h"
+#include "uart.h"
+
+/*********************************************************
+ * RX/TX turnaround
+ */
+static char const *frame_turnaround_text( enum frame_turnaround_dir dir ) {
+  static char const * const dir_text[FRM_TURNAROUND_MAX] = {
+    #define FRM_TURNAROUND( _e,_t ) _t,
+    FRM_TURNAROUND_LIST
+    #undef FRM_TURNAROUND
+  };
+
+  char const *text = "Unknown";
+  if( dir<FRM_TURNAROUND_MAX )
+    text = dir_text[dir];
+
+  return text;
+}
+
+static int frame_cmd_turnaround( int argc, char **argv ) {
+  enum frame_turnaround_dir dir;
+
+  if( argc>1 && !strcmp( argv[1], "reset" ) ) {
+    frame_turnaround_reset();
+    return 0;
+  }
+
+  printf("# %-8s %8s %8s %8s %8s %8s\n", "", "count", "last uS", "min uS", "avg uS", "max uS" );
+  for( dir=0 ; dir<FRM_TURNAROUND_MAX ; dir++ ) {
+    struct frame_turnaround const *t = frame_turnaround( dir );
+    uint32_t avg = t->count ? t->total / t->count : 0;
+    printf("# %-8s %8lu %8lu %8lu %8lu %8lu\n", frame_turnaround_text(dir), t->count, t->last, t->min, avg, t->max );
+  }
+
+  return 0;
+}
+
+/*********************************************************
+ * UART RX interrupt coalescing
+ */
+static int frame_cmd_uart( int argc, char **argv ) {
+  struct uart_rx_stats const *s;
+
+  if( argc>1 ) {
+    if( !strcmp( argv[1], "reset" ) ) {
+      uart_rx_stats_reset();
+      return 0;
+    }
+
+    s = uart_rx_stats();
+    uart_rx_set_threshold( atoi( argv[1] ), ( argc>2 ) ? atoi( argv[2] ) : s->timeout );
+    return 0;
+  }
+
+  s = uart_rx_stats();
+  if( s->elapsed ) {
+    uint32_t secs = s->elapsed / 1000000;
+    uint32_t rate = secs ? s->events / secs : s->events;
+    uint32_t bpe  = s->events ? s->bytes / s->events : 0;
+    // Busy time as 0.01% of elapsed
+    uint32_t load = (uint32_t)( ( 10000ULL * s->busy ) / s->elapsed );
+
+    printf("# threshold=%u timeout=%u\n", s->threshold, s->timeout );
+    printf("# events=%lu (%lu/s) bytes=%lu (%lu/event)\n", s->events, rate, s->bytes, bpe );
+    printf("# rx busy=%luuS in %lus load=%lu.%02lu%%\n", s->busy, secs, load/100, load%100 );
+  }
+
+  return 0;
+}
+
+/*********************************************************
+ * Top Level command
+ */
+
+static esp_console_cmd_t const frame_cmds[] = {
+  {
+    .command = "turnaround",
+    .help = "Show RX/TX turnaround times, 'turnaround reset' to clear",
+    .hint = NULL,
+    .func = &frame_cmd_turnaround,
+  },
+  {
+    .command = "uart",
+    .help = "Show UART RX interrupt stats, 'uart reset' to clear, 'uart <threshold> [<timeout>]' to set",
+    .hint = NULL,
+    .func = &frame_cmd_uart,
+  },
+  // List termination
+  { NULL_COMMAND }
+};
+
+static int frame_cmd( int argc, char **argv ) {
+  return cmd_menu( argc, argv, frame_cmds, argv[0] );
+}
+
+void frame_register(void) {
+  const esp_console_cmd_t frame[] = {
+    {
+      .command = "frame",
+      .help = "Frame commands, enter 'frame' for list",
+	  .hint = NULL,
+	  .func = &frame_cmd,
+    },
+	{ NULL_COMMAND }
+  };
+
+  cmd_menu_register( frame );
+}
@@ -0,0 +1,37 @@
+/********************************************************************
+ * ramses_esp
+ * frame_cmd.h
+ *
+ * (C) 2025 Peter Price
+ *
+ * Frame Commands
+ *
+ */
+#ifndef _FRAME_CMD_H_
+#define _FRAME_CMD_H_
+
+#include <stdint.h>
+
+#define FRM_TURNAROUND_LIST \
+  FRM_TURNAROUND( FRM_RX_TO_TX, "RX->TX" ) \
+  FRM_TURNAROUND( FRM_TX_TO_RX, "TX->RX" ) \
+
+#define FRM_TURNAROUND( _e, _t ) _e,
+enum frame_turnaround_dir {
+  FRM_TURNAROUND_LIST
+  FRM_TURNAROUND_MAX
+};
+#undef FRM_TURNAROUND
+
+struct frame_turnaround {
+  uint32_t count;
+  uint32_t total;   // uS
+  uint32_t min;     // uS
+  uint32_t max;     // uS
+  uint32_t last;    // uS
+};
+
+extern struct frame_turnaround const *frame_turnaround( enum frame_turnaround_dir dir );
+extern void frame_turnaround_reset( void );
+
+#endif // _FRAME_CMD_H_
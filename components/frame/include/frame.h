@@ -10,17 +10,23 @@
 #ifndef _FRAME_H_
 #define _FRAME_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 // UART interface
 #define FRM_START     0xF0
 #define FRM_LOST_SYNC 0xF1
 #define FRM_END       0xFF
 extern void frame_rx_byte(uint8_t byte);
+extern void frame_rx_bytes(uint8_t const *bytes, size_t n);
 
 extern void frame_tx_start(uint8_t *raw, uint8_t nRaw);
-extern uint8_t frame_tx_byte(uint8_t *byte);
+extern void frame_wake(void);
 
 extern void frame_disable(void);
 
+extern void frame_register(void);
+
 extern void frame_init(void);
 extern void frame_work(void);
 
@@ -0,0 +1,107 @@
+/********************************************************************
+ * ramses_esp
+ * manchester.h
+ *
+ * (C) 2023 Peter Price
+ *
+ * Manchester tables for the frame handler
+ *
+ * Kept apart from frame.c so tools/manchester_test.c can check them
+ * on a host.
+ *
+ */
+#ifndef _MANCHESTER_H_
+#define _MANCHESTER_H_
+
+#include <stdint.h>
+
+/*******************************************************
+* Manchester Encoding
+*
+* The [Evo Message] is encoded in the bitstream with a
+* Manchester encoding.  This is the only part of the
+* complete packet encoded in this way so we cannot
+* use the built in function of the CC1101
+*
+* While the bitstream is interpreted as a Big-endian stream
+* the manchester codes inserted in the stream are little-endian
+*
+* The Manchester data here is designed to correspond with the
+* Big-endian byte stream seen in the bitstream.
+*
+********
+* NOTE *
+********
+* The manchester decode process converts the data from
+*     8 bit little-endian to 4 bit big-endian
+* The manchester encode process converts the data from
+*     4 bit big-endian to 8 bit little-endian
+*
+* Since only a small subset of 8-bit values are actually allowed in
+* the bitstream rogue values can be used to identify some errors in
+* the bitstream.
+*
+*/
+
+// Convert big-endian 4 bits to little-endian byte
+static uint8_t const man_encode[16] = {
+  0xAA, 0xA9, 0xA6, 0xA5,  0x9A, 0x99, 0x96, 0x95,
+  0x6A, 0x69, 0x66, 0x65,  0x5A, 0x59, 0x56, 0x55
+};
+#define MAN_ENCODE(_i) man_encode[_i]
+
+// Convert little-endian 4 bits to 2-bit big endian
+static uint8_t const man_decode[16] = {
+  0xF, 0xF, 0xF, 0xF, 0xF, 0x3, 0x2, 0xF,
+  0xF, 0x1, 0x0, 0xF, 0xF, 0xF, 0xF, 0xF
+};
+#define MAN_DECODE(_i) man_decode[_i]
+
+static inline int manchester_code_valid( uint8_t code ) {
+ return ( MAN_DECODE( (code>>4)&0xF )!=0xF ) && ( MAN_DECODE( (code   )&0xF )!=0xF ) ;
+}
+
+static inline uint8_t manchester_decode( uint8_t byte ) {
+  uint8_t decoded;
+
+  decoded  = MAN_DECODE( ( byte    ) & 0xF );
+  decoded |= MAN_DECODE( ( byte>>4 ) & 0xF )<<2;
+
+  return decoded;
+}
+
+static inline uint8_t manchester_encode( uint8_t value ) {
+  return MAN_ENCODE(value & 0xF )
+  ;
+}
+
+/*
+ * Combined validate + decode of a received byte, the same result as
+ * manchester_code_valid() and manchester_decode() in a single lookup.
+ * Invalid codes map to MAN_INVALID.
+ * tools/manchester_test.c checks it against the tables above.
+ */
+#define MAN_INVALID 0xFF
+#define XX MAN_INVALID
+static uint8_t const man_rx[256] = {
+  /* 0_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* 1_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* 2_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* 3_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* 4_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* 5_ */ XX , XX , XX , XX , XX , 0xF, 0xE, XX , XX , 0xD, 0xC, XX , XX , XX , XX , XX ,
+  /* 6_ */ XX , XX , XX , XX , XX , 0xB, 0xA, XX , XX , 0x9, 0x8, XX , XX , XX , XX , XX ,
+  /* 7_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* 8_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* 9_ */ XX , XX , XX , XX , XX , 0x7, 0x6, XX , XX , 0x5, 0x4, XX , XX , XX , XX , XX ,
+  /* A_ */ XX , XX , XX , XX , XX , 0x3, 0x2, XX , XX , 0x1, 0x0, XX , XX , XX , XX , XX ,
+  /* B_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* C_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* D_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* E_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+  /* F_ */ XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX , XX ,
+};
+#undef XX
+#define MAN_RX(_b) man_rx[_b]
+
+#endif // _MANCHESTER_H_
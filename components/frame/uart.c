@@ -15,6 +15,7 @@
 
 #include <driver/uart.h>
 #include <hal/uart_hal.h>
+#include <esp_timer.h>
 
 static const char * TAG = "UART";
 #include "esp_log.h"
@@ -44,6 +45,49 @@ enum uart_mode {
 static enum uart_mode uartMode = uart_off;
 static bool uart_rx_on = false;
 
+/*******************************************************
+* RX statistics
+*/
+static struct uart_rx_stats rx_stats;
+
+struct uart_rx_stats const *uart_rx_stats(void) {
+  rx_stats.elapsed = (uint32_t)( esp_timer_get_time() - rx_stats.start );
+  return &rx_stats;
+}
+
+void uart_rx_stats_reset(void) {
+  uint8_t threshold = rx_stats.threshold;
+  uint8_t timeout   = rx_stats.timeout;
+
+  memset( &rx_stats, 0, sizeof(rx_stats) );
+  rx_stats.threshold = threshold;
+  rx_stats.timeout   = timeout;
+  rx_stats.start = esp_timer_get_time();
+}
+
+/*******************************************************
+* RX interrupt coalescing
+*
+* The UART interrupts when <threshold> bytes are in the RX FIFO
+* or when no data has arrived for <timeout> symbol times.
+* The cc1101 produces noise between frames so data arrives continuously,
+* the end of a frame is delayed by at most <threshold> byte times.
+*/
+void uart_rx_set_threshold( uint8_t threshold, uint8_t timeout ) {
+  if( threshold < 1 ) threshold = 1;
+  if( threshold > UART_RX_THRESHOLD_MAX ) threshold = UART_RX_THRESHOLD_MAX;
+  if( timeout > UART_RX_TIMEOUT_MAX ) timeout = UART_RX_TIMEOUT_MAX;
+
+  uart_set_rx_full_threshold( uart_num, threshold );
+  uart_set_rx_timeout( uart_num, timeout );
+
+  rx_stats.threshold = threshold;
+  rx_stats.timeout   = timeout;
+  uart_rx_stats_reset();
+
+  ESP_LOGI( TAG, "RX threshold=%d timeout=%d", threshold, timeout );
+}
+
 
 /*******************************************************
 * UART off
@@ -56,16 +100,9 @@ static void uart_work_off(void) {
 * UART RX
 */
 
+// Pending events are left for uart_work() to consume because uartQ
+// is a member of the radio task's queue set
 static void uart_rx_flush(void) {
-  UBaseType_t nMsg = uxQueueMessagesWaiting(uartQ);
-  if( nMsg ) {
-    UBaseType_t i;
-    for( i=0 ; i<nMsg ; i++ ) {
-      uart_event_t event;
-      xQueueReceive( uartQ, &event, portTICK_PERIOD_MS  );
-    }
-  }
-
   uart_flush_input(uart_num);
 }
 
@@ -86,22 +123,23 @@ static void rx_stop(void) {
 
 //---------------------------------------------------------------------------------
 
-static void uart_work_rx(void) {
-  uart_event_t event = {0};
-  if( xQueueReceive( uartQ, &event, portTICK_PERIOD_MS  )) {
-	DEBUG_UART(1);
-    if( event.type==UART_DATA && event.size > 0 ) {
-      uint8_t dtmp[256];
-      int i,n;
-      n = uart_read_bytes( uart_num, dtmp, event.size, portTICK_PERIOD_MS/10 );
-      for( i=0 ; i<n ;  i++ ) {
-        DEBUG_DATA(1);
-        frame_rx_byte( dtmp[i] );
-        DEBUG_DATA(0);
-      }
+static void uart_work_rx( uart_event_t const *event ) {
+  DEBUG_UART(1);
+  if( event->type==UART_DATA && event->size > 0 ) {
+    int64_t start = esp_timer_get_time();
+    uint8_t dtmp[256];
+    int n;
+    n = uart_read_bytes( uart_num, dtmp, event->size, portTICK_PERIOD_MS/10 );
+    if( n > 0 ) {
+      DEBUG_DATA(1);
+      frame_rx_bytes( dtmp, n );
+      DEBUG_DATA(0);
+      rx_stats.bytes += n;
     }
-    DEBUG_UART(0);
+    rx_stats.events++;
+    rx_stats.busy += (uint32_t)( esp_timer_get_time() - start );
   }
+  DEBUG_UART(0);
 }
 
 /*******************************************************
@@ -150,17 +188,22 @@ void uart_disable(void) {
   uartMode = uart_off;
 }
 
-void uart_work(void)
+void uart_work( QueueSetMemberHandle_t member )
 {
+  uart_event_t event = {0};
+
+  if( member!=uartQ || !xQueueReceive( uartQ, &event, 0 ) )
+    return;
+
   switch( uartMode ) {
-  case uart_off:  uart_work_off();  break;
-  case uart_rx:   uart_work_rx();   break;
-  case uart_tx:   uart_work_tx();   break;
+  case uart_off:  uart_work_off();        break;
+  case uart_rx:   uart_work_rx( &event ); break;
+  case uart_tx:   uart_work_tx();         break;
   }
 }
 
 
-void uart_init(void)
+void uart_init( QueueSetHandle_t events )
 {
   static uart_config_t const uart_config = {
     .baud_rate = RADIO_BAUDRATE,
@@ -172,8 +215,9 @@ void uart_init(void)
   };
 
   static uart_intr_config_t const uintr_cfg = {
-    .intr_enable_mask = UART_INTR_RXFIFO_FULL ,
-	.rxfifo_full_thresh = 1,
+    .intr_enable_mask = UART_INTR_RXFIFO_FULL | UART_INTR_RXFIFO_TOUT ,
+	.rxfifo_full_thresh = CONFIG_UART_RX_THRESHOLD,
+	.rx_timeout_thresh = CONFIG_UART_RX_TIMEOUT,
   };
 
   esp_log_level_set(TAG, CONFIG_UART_LOG_LEVEL );
@@ -182,9 +226,14 @@ void uart_init(void)
   ESP_ERROR_CHECK( uart_param_config( uart_num, &uart_config ) );
 
   //Install UART driver, and get the queue.
-  ESP_ERROR_CHECK( uart_driver_install( uart_num, 256,0 , 16,&uartQ, 0 ) );
+  ESP_ERROR_CHECK( uart_driver_install( uart_num, 256,0 , UART_EVENT_QUEUE_LEN,&uartQ, 0 ) );
+  xQueueAddToSet( uartQ, events );
 
   ESP_ERROR_CHECK( uart_intr_config( uart_num, &uintr_cfg ) );
 
+  rx_stats.threshold = CONFIG_UART_RX_THRESHOLD;
+  rx_stats.timeout   = CONFIG_UART_RX_TIMEOUT;
+  uart_rx_stats_reset();
+
   ESP_LOGI( TAG, "initialised" );
 }
@@ -10,12 +10,37 @@
 #ifndef _UART_H_
 #define _UART_H_
 
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
 extern void uart_rx_enable(void);
 extern void uart_tx_enable(void);
 extern void uart_disable(void);
 
-extern void uart_init(void);
-extern void uart_work(void);
+#define UART_EVENT_QUEUE_LEN 16
+
+extern void uart_init( QueueSetHandle_t events );
+extern void uart_work( QueueSetMemberHandle_t event );
+
+#define UART_RX_THRESHOLD_MAX 120
+#define UART_RX_TIMEOUT_MAX   126
+
+struct uart_rx_stats {
+  uint8_t threshold;  // RX FIFO bytes
+  uint8_t timeout;    // symbol times
+
+  uint32_t events;    // RX data events, one per interrupt
+  uint32_t bytes;
+  uint32_t busy;      // uS spent reading and decoding RX data
+  uint32_t elapsed;   // uS since stats were reset
+  int64_t start;
+};
+
+extern struct uart_rx_stats const *uart_rx_stats(void);
+extern void uart_rx_stats_reset(void);
+extern void uart_rx_set_threshold( uint8_t threshold, uint8_t timeout );
 
 #define RADIO_BAUDRATE 38400
 
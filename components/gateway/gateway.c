@@ -8,6 +8,8 @@
  * that is directly connected to the host via a USB port.
  *
  * RX messages are printed in the HGI80 format
+ * through the serial output buffer so a slow host never blocks the gateway.
+ * MQTT publishing has its own sink so neither transport delays the other.
  * TX messages are accepted from the host and forwarded to the Host task
  *
  */
@@ -18,11 +20,19 @@ static const char *TAG = "GATEWAY";
 #include "freertos/task.h"
 #include "freertos/queue.h"
 
+#include <stdatomic.h>
+#include <string.h>
+
 #include "esp_console.h"
 
+#include "cmd.h"
+#include "msg_bin.h"
+
 #include "ramses-mqtt.h"
 #include "device.h"
 #include "gateway.h"
+#include "serial_out.h"
+#include "sink.h"
 
 #define GWAY_CLASS 18
 #define GWAY_ID 730
@@ -30,10 +40,24 @@ static const char *TAG = "GATEWAY";
 static uint8_t  MyClass = GWAY_CLASS;
 static uint32_t MyId = GWAY_ID;
 
+// Only one RX drain request is pending at a time so a large pool
+// does not need a large queue
+#define GATEWAY_QUEUE_LEN ( ( CONFIG_N_MSG < 16 ) ? CONFIG_N_MSG : 16 )
+
 struct gateway_data {
   BaseType_t coreID;
   TaskHandle_t   task;
   QueueHandle_t  queue;
+
+  _Atomic uint8_t rx_pending;
+
+  _Atomic uint8_t binary;   // Serial port is in binary mode
+  uint32_t rxSeq;           // Binary RX record sequence number
+
+  // Serial output collected during one wakeup
+  uint16_t nBatch;
+  uint8_t  linesBatch;
+  char batch[SERIAL_OUT_MAX];
 };
 
 static struct gateway_data *gateway_ctxt( void ) {
@@ -57,16 +81,19 @@ struct gateway_msg {
   void *param;
 };
 
+// Never blocks, this is called from the radio task
 static BaseType_t gateway_msg_post( struct gateway_msg * msg ) {
   BaseType_t res = pdFALSE;
 
   struct gateway_data *ctxt = gateway_ctxt();
   if( ctxt && ctxt->queue )
-    res = xQueueSend( ctxt->queue, msg, portTICK_PERIOD_MS );
+    res = xQueueSend( ctxt->queue, msg, 0 );
 
   return res;
 }
 
+static void gateway_radio_rx_func( void *param );
+
 static void Gateway( void *param ) {
   struct gateway_data *ctxt = param;
 
@@ -74,55 +101,162 @@ static void Gateway( void *param ) {
 
   device_init( MyClass );
   device_get_id( &MyClass, &MyId );
-  ctxt->queue = xQueueCreate( 10, sizeof( struct gateway_msg ) );
+  ctxt->queue = xQueueCreate( GATEWAY_QUEUE_LEN, sizeof( struct gateway_msg ) );
 
   do {
     struct gateway_msg msg;
     BaseType_t res = xQueueReceive( ctxt->queue, &msg, portTICK_PERIOD_MS);
-    if( res ){
+
+    // A drain request may have been lost to a full queue
+    if( !res )
+      gateway_radio_rx_func( ctxt );
+
+    // Handle everything queued before writing the output once
+    while( res ) {
       if( msg.msgFunc )
         ( msg.msgFunc )( msg.param );
+      res = xQueueReceive( ctxt->queue, &msg, 0 );
     }
+
+    sink_flush();
   } while(1);
 }
 
+/*************************************************************************
+ * Serial sink
+ *
+ * Lines and records are collected in one buffer which is handed
+ * to the serial output as a single write per wakeup,
+ * or sooner if it fills.
+ */
+
+static void gateway_batch_flush( struct gateway_data *ctxt, struct sink *sink ) {
+  if( ctxt->nBatch ) {
+    if( serial_out_batch( ctxt->batch, ctxt->nBatch, ctxt->linesBatch ) )
+      sink->stats.written += ctxt->linesBatch;
+    else
+      sink->stats.drop[SINK_DROP_FULL] += ctxt->linesBatch;
+
+    ctxt->nBatch = 0;
+    ctxt->linesBatch = 0;
+  }
+}
+
+static inline char *gateway_batch_tail( struct gateway_data *ctxt ) {
+  return ctxt->batch + ctxt->nBatch;
+}
+
+static inline uint16_t gateway_batch_space( struct gateway_data *ctxt ) {
+  return sizeof(ctxt->batch) - ctxt->nBatch;
+}
+
+static void gateway_bin_rx( struct gateway_data *ctxt, struct sink *sink, struct message const *msg );
+
+static void serial_sink_post( struct sink *sink, struct sink_msg *fmt, struct message const *msg ) {
+  struct gateway_data *ctxt = gateway_ctxt();
+
+  // Binary mode also carries errored frames
+  if( atomic_load( &ctxt->binary ) ) {
+    gateway_bin_rx( ctxt, sink, msg );
+  } else if( fmt->len ) {
+    if( gateway_batch_space( ctxt ) < fmt->len+1 )
+      gateway_batch_flush( ctxt, sink );
+
+    memcpy( gateway_batch_tail( ctxt ), fmt->line, fmt->len );
+    ctxt->batch[ ctxt->nBatch + fmt->len ] = '\n';
+    ctxt->nBatch += fmt->len+1;
+    ctxt->linesBatch++;
+  }
+}
+
+static void serial_sink_flush( struct sink *sink ) {
+  gateway_batch_flush( gateway_ctxt(), sink );
+}
+
+static struct sink_ops const serial_sink_ops = {
+  .post  = serial_sink_post,
+  .flush = serial_sink_flush,
+};
+
+static struct sink serial_sink = {
+  .name = "serial",
+  .ops = &serial_sink_ops,
+};
+
+/*************************************************************************
+ * MQTT sink
+ */
+
+static void mqtt_sink_post( struct sink *sink, struct sink_msg *fmt, struct message const *msg ) {
+  if( fmt->len )
+    sink_queue( sink, fmt );
+}
+
+static void mqtt_sink_write( struct sink *sink, struct sink_msg *fmt ) {
+  MQTT_publish_rx( fmt->ts, fmt->line );
+}
+
+// Publishes an RX batch once it is old enough
+static TickType_t mqtt_sink_poll( struct sink *sink ) {
+  return MQTT_publish_rx_poll();
+}
+
+static struct sink_ops const mqtt_sink_ops = {
+  .post  = mqtt_sink_post,
+  .write = mqtt_sink_write,
+  .poll  = mqtt_sink_poll,
+};
+
+static struct sink mqtt_sink = {
+  .name = "mqtt",
+  .ops = &mqtt_sink_ops,
+};
+
 /*************************************************************************
  * Actions
  */
 
-static void gateway_radio_rx_func( void *param ) {
-  struct message *msg = param;
+static void gateway_radio_rx_msg( struct gateway_data *ctxt, struct message *msg ) {
   ESP_LOGI( TAG, "process rx message %p",msg);
 
   if( msg ) {
-    char msgBuff[256];
-    uint8_t len = msg_print_all( msg, msgBuff );
-    if( len ) {
-      if( msg_isValid(msg) ) {
-        printf("%s\n",msgBuff);
-        MQTT_publish_rx( msg_get_ts(msg), msgBuff );
-      }
-      else {
-        ESP_LOGW( TAG,"Dropped <%s>",msgBuff );
-      }
-    }
+    sink_fanout( msg );
     msg_free( &msg );
   }
 }
 
-void gateway_radio_rx( struct message **message ) {
-  struct gateway_msg msg = {
-    .msgFunc = gateway_radio_rx_func,
-	.param = *message
-  };
+static void gateway_radio_rx_func( void *param ) {
+  struct gateway_data *ctxt = param;
+  struct message *msg;
 
-  BaseType_t res = gateway_msg_post( &msg );
-  if( !res ) {
-	ESP_LOGE( TAG, "failed to post rx message");
-	msg_free( message );
-  } else {
-	*message = NULL;  // We own message now
+  // Anything arriving from now on needs a new request
+  atomic_store( &ctxt->rx_pending, 0 );
+
+  while( ( msg = msg_rx_get() ) != NULL )
+    gateway_radio_rx_msg( ctxt, msg );
+}
+
+// Messages are waiting in the RX list
+// Only one request is needed to drain the list so only post if none is pending.
+// If the post fails the messages are collected by the next request,
+// or when the gateway task next times out.
+// Returns 0 if the gateway could not be told.
+uint8_t gateway_radio_rx( void ) {
+  struct gateway_data *ctxt = gateway_ctxt();
+
+  if( !atomic_exchange( &ctxt->rx_pending, 1 ) ) {
+    struct gateway_msg msg = {
+      .msgFunc = gateway_radio_rx_func,
+	  .param = ctxt
+    };
+
+    if( !gateway_msg_post( &msg ) ) {
+      atomic_store( &ctxt->rx_pending, 0 );
+      return 0;
+    }
   }
+
+  return 1;
 }
 
 /*************************************************************************
@@ -130,21 +264,14 @@ void gateway_radio_rx( struct message **message ) {
  */
 
 static void tx_msg( char const *cmd ){
-  struct message *tx = msg_alloc();
+  struct message *tx = msg_alloc( MSG_POOL_TX );
   if( tx ) {
-	uint8_t err = 0, done=0;
-	while( !err && *cmd != '\0' )
-	  err = msg_scan( tx, *(cmd++) );
-
-	if( !err )
-	  done = msg_scan( tx, '\r' );
-
-	if( done && msg_isValid( tx ) ) {
+	uint16_t errPos;
+	if( msg_parse( tx, cmd, strlen(cmd), &errPos )==MSG_OK && msg_isValid( tx ) ) {
       msg_change_addr( tx,0, GWAY_CLASS,GWAY_ID , MyClass,MyId );
       msg_tx_ready( &tx );
-//    } else if( TRACE(TRC_TXERR) ) {
-//      msg_rx_ready( &tx );
     } else {
+      ESP_LOGW( TAG, "Bad TX at %u <%s>", errPos, cmd );
       msg_free( &tx );
     }
   } else {
@@ -156,6 +283,79 @@ void gateway_tx( char const *msg ) {
   tx_msg( msg );
 }
 
+/*************************************************************************
+ * Structured TX messages
+ */
+
+static uint8_t tx_queue( struct message *tx, uint8_t err ) {
+  if( err==MSG_OK ) {
+    msg_change_addr( tx,0, GWAY_CLASS,GWAY_ID , MyClass,MyId );
+    msg_tx_ready( &tx );
+  } else {
+    msg_free( &tx );
+  }
+
+  return err;
+}
+
+uint8_t gateway_tx_fields( struct msg_tx const *fields ) {
+  struct message *tx = msg_alloc( MSG_POOL_TX );
+  if( !tx ) {
+    ESP_LOGW( TAG, "DROPPED structured TX" );
+    return MSG_BAD_TX;
+  }
+
+  return tx_queue( tx, msg_tx_fields( tx, fields ) );
+}
+
+uint8_t gateway_tx_frame( uint8_t const *frame, uint8_t nBytes ) {
+  struct message *tx = msg_alloc( MSG_POOL_TX );
+  if( !tx ) {
+    ESP_LOGW( TAG, "DROPPED frame TX" );
+    return MSG_BAD_TX;
+  }
+
+  return tx_queue( tx, msg_tx_frame( tx, frame, nBytes ) );
+}
+
+static uint8_t hex_nibble( char c ) {
+  if( c>='0' && c<='9' ) return c - '0';
+  if( c>='A' && c<='F' ) return c - 'A' + 10;
+  if( c>='a' && c<='f' ) return c - 'a' + 10;
+  return 0xFF;
+}
+
+// Frame bytes as a string of hex digits
+uint8_t gateway_tx_hex( char const *hex, uint16_t len ) {
+  uint8_t frame[MSG_TX_FRAME_MAX];
+  uint8_t nBytes = 0;
+  uint16_t i;
+
+  if( len & 1 || len/2 > sizeof(frame) )
+    return MSG_BAD_TX;
+
+  for( i=0 ; i<len ; i+=2 ) {
+    uint8_t hi = hex_nibble( hex[i] );
+    uint8_t lo = hex_nibble( hex[i+1] );
+    if( ( hi|lo ) & 0xF0 )
+      return MSG_BAD_TX;
+    frame[nBytes++] = ( hi<<4 ) | lo;
+  }
+
+  return gateway_tx_frame( frame, nBytes );
+}
+
+static int gateway_radio_tx_frame( int argc, char **argv ) {
+  if( argc==2 ) {
+    uint8_t err = gateway_tx_hex( argv[1], strlen( argv[1] ) );
+    if( err )
+      ESP_LOGW( TAG, "Bad TX frame <%s>", argv[1] );
+  } else {
+    printf("# TX <hex frame bytes>\n");
+  }
+  return 0;
+}
+
 static int gateway_radio_tx(int argc, char **argv) {
   if( argc==8 ) {
 	char msg[256];
@@ -196,10 +396,146 @@ static void gateway_register_tx(void) {
         .func = &gateway_radio_tx,
     };
 
+    const esp_console_cmd_t frame = {
+        .command = "TX",
+        .help = "Send frame bytes given as hex, checksum optional",
+        .hint = NULL,
+        .func = &gateway_radio_tx_frame,
+    };
+
     ESP_ERROR_CHECK( esp_console_cmd_register(&i ) );
     ESP_ERROR_CHECK( esp_console_cmd_register(&w ) );
     ESP_ERROR_CHECK( esp_console_cmd_register(&rq) );
     ESP_ERROR_CHECK( esp_console_cmd_register(&rp) );
+    ESP_ERROR_CHECK( esp_console_cmd_register(&frame) );
+}
+
+/*************************************************************************
+ * Binary serial mode
+ *
+ * 'binary on' switches the serial port to COBS framed records,
+ * see msg_bin.h. The text format remains the default.
+ * A MSG_BIN_CTRL_TEXT record returns to text mode.
+ */
+
+static void gateway_bin_write( uint8_t type, uint32_t seq, uint8_t const *body, size_t nBody ) {
+  uint8_t rec[ MSG_BIN_RECORD_MAX ];
+  size_t n = msg_bin_record( type, seq, body, nBody, rec, sizeof(rec) );
+
+  if( n )
+    serial_out_write( rec, n );
+}
+
+static void gateway_bin_rx( struct gateway_data *ctxt, struct sink *sink, struct message const *msg ) {
+  struct msg_bin_rx rx;
+  uint8_t body[MSG_BIN_RX_MAX];
+  size_t n;
+
+  msg_bin_get( msg, &rx );
+  n = msg_bin_pack_rx( &rx, body, sizeof(body) );
+  if( n ) {
+    if( gateway_batch_space( ctxt ) < MSG_BIN_RECORD_MAX )
+      gateway_batch_flush( ctxt, sink );
+
+    n = msg_bin_record( MSG_BIN_RX, ctxt->rxSeq++, body, n,
+                        (uint8_t *)gateway_batch_tail( ctxt ), gateway_batch_space( ctxt ) );
+    if( n ) {
+      ctxt->nBatch += n;
+      ctxt->linesBatch++;
+    }
+  }
+}
+
+static void gateway_bin_status( uint32_t seq, uint8_t status ) {
+  gateway_bin_write( MSG_BIN_STATUS, seq, &status, 1 );
+}
+
+static void gateway_bin_record( uint8_t const *rec, size_t n ) {
+  struct gateway_data *ctxt = gateway_ctxt();
+  uint8_t type;
+  uint32_t seq;
+  int nBody = msg_bin_check( rec, n, &type, &seq );
+  uint8_t const *body = rec + MSG_BIN_HDR;
+
+  if( nBody<0 ) {
+    ESP_LOGW( TAG, "Bad binary record" );
+    return;
+  }
+
+  switch( type ) {
+  case MSG_BIN_TX:
+    gateway_bin_status( seq, ( nBody<=MSG_TX_FRAME_MAX ) ? gateway_tx_frame( body, nBody ) : MSG_BAD_TX );
+    break;
+
+  case MSG_BIN_CTRL:
+    if( nBody==1 && body[0]==MSG_BIN_CTRL_TEXT ) {
+      gateway_bin_status( seq, MSG_OK );
+      atomic_store( &ctxt->binary, 0 );
+      cmd_set_input( NULL );
+    } else if( nBody==1 && body[0]==MSG_BIN_CTRL_PING ) {
+      gateway_bin_status( seq, MSG_OK );
+    } else {
+      gateway_bin_status( seq, MSG_BAD_TX );
+    }
+    break;
+
+  default:
+    gateway_bin_status( seq, MSG_BAD_TX );
+    break;
+  }
+}
+
+// Console input while in binary mode, runs in the host task
+static void gateway_bin_input( char const *bytes, int n ) {
+  static uint8_t enc[ MSG_BIN_COBS_MAX( MSG_BIN_RX_MAX ) ];
+  static size_t nEnc;
+  static uint8_t overflow;
+
+  while( n-- ) {
+    uint8_t byte = *(bytes++);
+
+    if( byte ) {
+      if( nEnc < sizeof(enc) )
+        enc[nEnc++] = byte;
+      else
+        overflow = 1;
+    } else {
+      uint8_t rec[MSG_BIN_RX_MAX];
+      size_t nRec = overflow ? 0 : msg_bin_cobs_decode( enc, nEnc, rec, sizeof(rec) );
+      if( nRec )
+        gateway_bin_record( rec, nRec );
+
+      nEnc = 0;
+      overflow = 0;
+    }
+  }
+}
+
+static int gateway_binary_cmd( int argc, char **argv ) {
+  struct gateway_data *ctxt = gateway_ctxt();
+
+  if( argc==2 && !strcmp( argv[1], "on" ) ) {
+    // Queued behind any text lines still waiting to be written
+    static char const on[] = "# binary on";
+    serial_out_line( on, sizeof(on)-1 );
+    cmd_set_input( gateway_bin_input );
+    atomic_store( &ctxt->binary, 1 );
+  } else {
+    printf("# binary on - switch to COBS framed records, see msg_bin.h\n");
+  }
+
+  return 0;
+}
+
+static void gateway_register_bin(void) {
+  const esp_console_cmd_t binary = {
+    .command = "binary",
+    .help = "Switch the serial port to binary records",
+    .hint = NULL,
+    .func = &gateway_binary_cmd,
+  };
+
+  ESP_ERROR_CHECK( esp_console_cmd_register( &binary ) );
 }
 
 /*************************************************************************
@@ -213,6 +549,14 @@ void gateway_init( BaseType_t coreID ) {
   esp_log_level_set(TAG, CONFIG_GWAY_LOG_LEVEL );
 
   gateway_register_tx();
+  gateway_register_bin();
+
+  serial_out_init( ctxt->coreID );
+
+  sink_init();
+  sink_register( &serial_sink );
+  sink_register( &mqtt_sink );
+  sink_start( &mqtt_sink, CONFIG_GWAY_SINK_DEPTH, 5, ctxt->coreID );
 
   xTaskCreatePinnedToCore( Gateway, "Gateway", 4096, ctxt, 10, &ctxt->task, ctxt->coreID );
 }
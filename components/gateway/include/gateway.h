@@ -13,9 +13,15 @@
 #include "freertos/FreeRTOS.h"
 
 #include "message.h"
-extern void gateway_radio_rx( struct message **message );
+extern uint8_t gateway_radio_rx( void );
 extern void gateway_tx( char const *msg );
 
+// Header + 3 addresses + 2 params + opcode + len + payload + checksum
+#define MSG_TX_FRAME_MAX ( 1 + 9 + 2 + 2 + 1 + 64 + 1 )
+extern uint8_t gateway_tx_fields( struct msg_tx const *fields );
+extern uint8_t gateway_tx_frame( uint8_t const *frame, uint8_t nBytes );
+extern uint8_t gateway_tx_hex( char const *hex, uint16_t len );
+
 extern void gateway_init( BaseType_t coreID );
 
 #endif // _GATEWAY_H_
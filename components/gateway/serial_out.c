@@ -0,0 +1,310 @@
+/********************************************************************
+ * ramses_esp
+ * serial_out.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Buffered serial output
+ *
+ * Producers copy whole lines or records into a byte ring, each entry
+ * is preceded by its 2 byte length and the number of lines it holds.
+ * Nothing is ever written partially; if an entry does not fit it is
+ * dropped and counted.
+ *
+ * The lock only covers moving head and tail. Producers reserve their
+ * entry, copy into it and then mark it ready, the writer copies out
+ * ready entries before releasing their space.
+ *
+ * The writer task copies entries out of the ring and writes them to
+ * the console. With coalescing enabled it collects as many complete
+ * entries as fit in one write.
+ *
+ */
+static const char *TAG = "SERIAL";
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_console.h"
+
+#include "serial_out.h"
+
+#define SERIAL_BUF   CONFIG_GWAY_SERIAL_BUF
+#define SERIAL_CHUNK CONFIG_GWAY_SERIAL_CHUNK
+#define SERIAL_HDR   4
+#define SERIAL_READY 3    // Header byte set once the entry is complete
+
+struct serial_out {
+  portMUX_TYPE lock;
+  TaskHandle_t task;
+
+  uint32_t head;  // Writer, released once copied out
+  uint32_t tail;  // Producers, reserved before copying in
+  uint8_t buf[SERIAL_BUF];
+
+  struct serial_out_stats stats;
+};
+
+static struct serial_out serial = {
+  .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static inline uint32_t ring_level( struct serial_out *s ) {
+  return s->tail - s->head;
+}
+
+static void ring_copy_in( struct serial_out *s, uint32_t at, void const *data, size_t n ) {
+  uint32_t pos = at % SERIAL_BUF;
+  size_t first = SERIAL_BUF - pos;
+
+  if( first > n )
+    first = n;
+  memcpy( s->buf+pos, data, first );
+  memcpy( s->buf, (uint8_t const *)data + first, n - first );
+}
+
+static void ring_copy_out( struct serial_out *s, uint32_t at, void *data, size_t n ) {
+  uint32_t pos = at % SERIAL_BUF;
+  size_t first = SERIAL_BUF - pos;
+
+  if( first > n )
+    first = n;
+  memcpy( data, s->buf+pos, first );
+  memcpy( (uint8_t *)data + first, s->buf, n - first );
+}
+
+static void serial_drop( struct serial_out *s, enum serial_drop reason, uint32_t lines, uint32_t bytes ) {
+  s->stats.dropLines[reason] += lines;
+  s->stats.dropBytes[reason] += bytes;
+}
+
+/*************************************************************************
+ * Producers
+ */
+
+// <data> followed by optional <tail> as a single entry of <lines>
+static uint8_t serial_put( void const *data, size_t n, void const *tail, size_t nTail, uint8_t lines ) {
+  struct serial_out *s = &serial;
+  size_t len = n + nTail;
+  uint8_t hdr[SERIAL_HDR] = { len, len>>8, lines, 0 };
+  uint32_t at;
+
+  taskENTER_CRITICAL( &s->lock );
+
+  if( len > SERIAL_CHUNK ) {
+    serial_drop( s, SERIAL_DROP_SIZE, lines, len );
+    taskEXIT_CRITICAL( &s->lock );
+    return 0;
+  }
+
+  if( SERIAL_HDR + len > SERIAL_BUF - ring_level(s) ) {
+    serial_drop( s, SERIAL_DROP_FULL, lines, len );
+    taskEXIT_CRITICAL( &s->lock );
+    return 0;
+  }
+
+  // Reserve the entry, the writer stops at it until it is ready
+  at = s->tail;
+  s->tail += SERIAL_HDR + len;
+  ring_copy_in( s, at, hdr, SERIAL_HDR );
+
+  if( ring_level(s) > s->stats.hwm )
+    s->stats.hwm = ring_level(s);
+
+  taskEXIT_CRITICAL( &s->lock );
+
+  ring_copy_in( s, at+SERIAL_HDR, data, n );
+  if( nTail )
+    ring_copy_in( s, at+SERIAL_HDR+n, tail, nTail );
+
+  taskENTER_CRITICAL( &s->lock );
+  s->buf[ ( at+SERIAL_READY ) % SERIAL_BUF ] = 1;
+  taskEXIT_CRITICAL( &s->lock );
+
+  if( s->task )
+    xTaskNotifyGive( s->task );
+
+  return 1;
+}
+
+uint8_t serial_out_write( void const *data, size_t n ) {
+  return serial_put( data, n, NULL, 0, 1 );
+}
+
+uint8_t serial_out_batch( void const *data, size_t n, uint8_t lines ) {
+  return serial_put( data, n, NULL, 0, lines );
+}
+
+uint8_t serial_out_line( char const *line, size_t n ) {
+  return serial_put( line, n, "\n", 1, 1 );
+}
+
+/*************************************************************************
+ * Writer
+ */
+
+// Copy complete entries into <chunk>, returns the number of bytes.
+// Only the headers are read under the lock. Entries before <end> are
+// ready and nothing reuses their space until head is moved past them.
+static size_t serial_get( struct serial_out *s, uint8_t *chunk, uint32_t *lines ) {
+  uint8_t hdr[SERIAL_HDR];
+  uint32_t at, end;
+  size_t n = 0;
+
+  taskENTER_CRITICAL( &s->lock );
+
+  end = s->head;
+  while( end != s->tail ) {
+    size_t len;
+
+    ring_copy_out( s, end, hdr, SERIAL_HDR );
+    len = hdr[0] | hdr[1]<<8;
+    if( !hdr[SERIAL_READY] || n + len > SERIAL_CHUNK )
+      break;    // Leave it for the next write
+
+    end += SERIAL_HDR + len;
+    n += len;
+    (*lines) += hdr[2];
+
+#if !CONFIG_GWAY_SERIAL_COALESCE
+    break;
+#endif
+  }
+
+  taskEXIT_CRITICAL( &s->lock );
+
+  for( at=s->head, n=0 ; at != end ; ) {
+    size_t len;
+
+    ring_copy_out( s, at, hdr, SERIAL_HDR );
+    len = hdr[0] | hdr[1]<<8;
+    ring_copy_out( s, at+SERIAL_HDR, chunk+n, len );
+
+    at += SERIAL_HDR + len;
+    n += len;
+  }
+
+  taskENTER_CRITICAL( &s->lock );
+  s->head = end;
+  taskEXIT_CRITICAL( &s->lock );
+
+  return n;
+}
+
+static void SerialOut( void *param ) {
+  struct serial_out *s = param;
+  static uint8_t chunk[SERIAL_CHUNK];
+
+  ESP_LOGI( TAG, "Task Started");
+
+  do {
+    uint32_t lines = 0;
+    size_t n = serial_get( s, chunk, &lines );
+
+    if( n ) {
+      size_t written = fwrite( chunk, 1, n, stdout );
+      fflush( stdout );
+
+      taskENTER_CRITICAL( &s->lock );
+      s->stats.writes++;
+      if( written==n ) {
+        s->stats.lines += lines;
+        s->stats.bytes += n;
+      } else {
+        serial_drop( s, SERIAL_DROP_WRITE, lines, n-written );
+        s->stats.bytes += written;
+      }
+      taskEXIT_CRITICAL( &s->lock );
+    } else {
+      ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+    }
+  } while(1);
+}
+
+/*************************************************************************
+ * Statistics
+ */
+
+void serial_out_stats( struct serial_out_stats *stats ) {
+  struct serial_out *s = &serial;
+
+  taskENTER_CRITICAL( &s->lock );
+  (*stats) = s->stats;
+  stats->size  = SERIAL_BUF;
+  stats->level = ring_level(s);
+  taskEXIT_CRITICAL( &s->lock );
+}
+
+void serial_out_stats_reset( void ) {
+  struct serial_out *s = &serial;
+
+  taskENTER_CRITICAL( &s->lock );
+  memset( &s->stats, 0, sizeof(s->stats) );
+  taskEXIT_CRITICAL( &s->lock );
+}
+
+static char const *serial_drop_text( enum serial_drop reason ) {
+  static char const * const drop_text[SERIAL_DROP_MAX] = {
+    #define SERIAL_DROP( _e,_t ) _t,
+    SERIAL_DROP_LIST
+    #undef SERIAL_DROP
+  };
+
+  char const *text = "Unknown";
+  if( reason<SERIAL_DROP_MAX )
+    text = drop_text[reason];
+
+  return text;
+}
+
+static int serial_out_cmd( int argc, char **argv ) {
+  struct serial_out_stats stats;
+  enum serial_drop reason;
+
+  if( argc>1 && !strcmp( argv[1], "reset" ) ) {
+    serial_out_stats_reset();
+    return 0;
+  }
+
+  serial_out_stats( &stats );
+
+  printf("# %-6s %8s %8s %8s %10s %10s %10s\n", "buffer", "size", "level", "hwm", "lines", "bytes", "writes" );
+  printf("# %-6s %8lu %8lu %8lu %10lu %10lu %10lu\n", "serial",
+         stats.size, stats.level, stats.hwm, stats.lines, stats.bytes, stats.writes );
+
+  printf("# %-6s %10s %10s\n", "drop", "lines", "bytes" );
+  for( reason=0 ; reason<SERIAL_DROP_MAX ; reason++ ) {
+    printf("# %-6s %10lu %10lu\n", serial_drop_text(reason),
+           stats.dropLines[reason], stats.dropBytes[reason] );
+  }
+
+  return 0;
+}
+
+static void serial_out_register( void ) {
+  const esp_console_cmd_t cmd = {
+    .command = "serial",
+    .help = "Show serial output buffer and drops, 'serial reset' to clear",
+    .hint = NULL,
+    .func = &serial_out_cmd,
+  };
+
+  ESP_ERROR_CHECK( esp_console_cmd_register( &cmd ) );
+}
+
+/*************************************************************************
+ * External API
+ */
+
+void serial_out_init( BaseType_t coreID ) {
+  esp_log_level_set( TAG, CONFIG_GWAY_LOG_LEVEL );
+
+  serial_out_register();
+
+  // Lower priority than the gateway, it only has to keep up on average
+  xTaskCreatePinnedToCore( SerialOut, "SerialOut", 3072, &serial, 5, &serial.task, coreID );
+}
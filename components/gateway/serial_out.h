@@ -0,0 +1,58 @@
+/********************************************************************
+ * ramses_esp
+ * serial_out.h
+ *
+ * (C) 2025 Peter Price
+ *
+ * Buffered serial output
+ *
+ * Lines and records for the host are copied into a ring and written
+ * to the console by a separate task so a slow or absent host never
+ * blocks the gateway.
+ *
+ */
+#ifndef _SERIAL_OUT_H_
+#define _SERIAL_OUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#define SERIAL_DROP_LIST \
+  SERIAL_DROP( SERIAL_DROP_FULL,  "full" )  /* No room in the ring */ \
+  SERIAL_DROP( SERIAL_DROP_SIZE,  "size" )  /* Larger than a single write */ \
+  SERIAL_DROP( SERIAL_DROP_WRITE, "write" ) /* Console write failed */ \
+
+#define SERIAL_DROP( _e, _t ) _e,
+enum serial_drop {
+  SERIAL_DROP_LIST
+  SERIAL_DROP_MAX
+};
+#undef SERIAL_DROP
+
+struct serial_out_stats {
+  uint32_t size;
+  uint32_t level;   // Bytes waiting
+  uint32_t hwm;
+  uint32_t lines;   // Lines or records written
+  uint32_t bytes;
+  uint32_t writes;  // Console writes, less than lines when coalescing
+  uint32_t dropLines[SERIAL_DROP_MAX];
+  uint32_t dropBytes[SERIAL_DROP_MAX];
+};
+
+// Largest single write, anything bigger is dropped
+#define SERIAL_OUT_MAX CONFIG_GWAY_SERIAL_CHUNK
+
+// Never block, return 0 if the data was dropped
+extern uint8_t serial_out_write( void const *data, size_t n );
+extern uint8_t serial_out_line( char const *line, size_t n );  // Appends '\n'
+extern uint8_t serial_out_batch( void const *data, size_t n, uint8_t lines );
+
+extern void serial_out_stats( struct serial_out_stats *stats );
+extern void serial_out_stats_reset( void );
+
+extern void serial_out_init( BaseType_t coreID );
+
+#endif // _SERIAL_OUT_H_
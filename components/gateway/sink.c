@@ -0,0 +1,221 @@
+/********************************************************************
+ * ramses_esp
+ * sink.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * RX fan-out to output sinks
+ *
+ * The formatted messages come from a fixed pool, a FreeRTOS queue
+ * holds the free ones. The last sink to release a message returns it.
+ *
+ * If the pool is empty the gateway formats into a fallback message
+ * that cannot be held. Synchronous sinks still get it, asynchronous
+ * sinks count it as a pool drop.
+ *
+ */
+static const char *TAG = "SINK";
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_console.h"
+
+#include "sink.h"
+
+#define SINK_MSGS CONFIG_GWAY_SINK_MSGS
+
+static struct sink_data {
+  struct sink *sinks;
+
+  QueueHandle_t free;
+  struct sink_msg pool[SINK_MSGS];
+  struct sink_msg fallback;
+} sink_data;
+
+/*************************************************************************
+ * Shared messages
+ */
+
+uint8_t sink_msg_hold( struct sink_msg *fmt ) {
+  if( !fmt->pooled )
+    return 0;
+
+  atomic_fetch_add( &fmt->refs, 1 );
+  return 1;
+}
+
+void sink_msg_release( struct sink_msg *fmt ) {
+  if( atomic_fetch_sub( &fmt->refs, 1 )==1 && fmt->pooled )
+    xQueueSend( sink_data.free, &fmt, 0 );
+}
+
+static struct sink_msg *sink_msg_alloc( void ) {
+  struct sink_msg *fmt;
+
+  if( !sink_data.free || !xQueueReceive( sink_data.free, &fmt, 0 ) )
+    fmt = &sink_data.fallback;
+
+  atomic_store( &fmt->refs, 1 );
+  fmt->len = 0;
+
+  return fmt;
+}
+
+/*************************************************************************
+ * Asynchronous sinks
+ */
+
+void sink_queue( struct sink *sink, struct sink_msg *fmt ) {
+  if( !sink->queue || !sink_msg_hold( fmt ) ) {
+    sink->stats.drop[SINK_DROP_POOL]++;
+    return;
+  }
+
+  if( xQueueSend( sink->queue, &fmt, 0 ) ) {
+    uint32_t level = uxQueueMessagesWaiting( sink->queue );
+    if( level > sink->stats.hwm )
+      sink->stats.hwm = level;
+  } else {
+    sink_msg_release( fmt );
+    sink->stats.drop[SINK_DROP_FULL]++;
+  }
+}
+
+static void SinkWorker( void *param ) {
+  struct sink *sink = param;
+  TickType_t wait = portMAX_DELAY;
+
+  ESP_LOGI( TAG, "%s Task Started", sink->name );
+
+  do {
+    struct sink_msg *fmt;
+    if( xQueueReceive( sink->queue, &fmt, wait ) ) {
+      ( sink->ops->write )( sink, fmt );
+      sink->stats.written++;
+      sink_msg_release( fmt );
+    }
+
+    if( sink->ops->poll )
+      wait = ( sink->ops->poll )( sink );
+  } while(1);
+}
+
+void sink_start( struct sink *sink, uint32_t depth, UBaseType_t priority, BaseType_t coreID ) {
+  sink->depth = depth;
+  sink->queue = xQueueCreate( depth, sizeof( struct sink_msg * ) );
+
+  xTaskCreatePinnedToCore( SinkWorker, sink->name, 4096, sink, priority, &sink->task, coreID );
+}
+
+/*************************************************************************
+ * Fan-out
+ */
+
+void sink_register( struct sink *sink ) {
+  struct sink **pp = &sink_data.sinks;
+
+  // Keep registration order
+  while( *pp )
+    pp = &(*pp)->next;
+
+  sink->next = NULL;
+  (*pp) = sink;
+}
+
+void sink_fanout( struct message *msg ) {
+  struct sink_msg *fmt = sink_msg_alloc();
+  struct sink *sink;
+
+  if( msg_isValid( msg ) ) {
+    fmt->len = msg_format( msg, fmt->line, sizeof(fmt->line) );
+    msg_get_ts( msg, fmt->ts, sizeof(fmt->ts) );
+  } else if( msg_format( msg, fmt->line, sizeof(fmt->line) ) ) {
+    ESP_LOGW( TAG,"Dropped <%s>",fmt->line );
+  }
+
+  for( sink=sink_data.sinks ; sink ; sink=sink->next ) {
+    sink->stats.posted++;
+    ( sink->ops->post )( sink, fmt, msg );
+  }
+
+  sink_msg_release( fmt );
+}
+
+void sink_flush( void ) {
+  struct sink *sink;
+
+  for( sink=sink_data.sinks ; sink ; sink=sink->next ) {
+    if( sink->ops->flush )
+      ( sink->ops->flush )( sink );
+  }
+}
+
+/*************************************************************************
+ * Statistics
+ */
+
+static void sink_stats( struct sink *sink, struct sink_stats *stats ) {
+  (*stats) = sink->stats;
+  stats->depth = sink->depth;
+  stats->level = sink->queue ? uxQueueMessagesWaiting( sink->queue ) : 0;
+}
+
+static int sink_cmd( int argc, char **argv ) {
+  struct sink *sink;
+
+  if( argc>1 && !strcmp( argv[1], "reset" ) ) {
+    for( sink=sink_data.sinks ; sink ; sink=sink->next )
+      memset( &sink->stats, 0, sizeof(sink->stats) );
+    return 0;
+  }
+
+  printf("# shared messages %u free %lu\n", SINK_MSGS,
+         sink_data.free ? uxQueueMessagesWaiting( sink_data.free ) : 0 );
+
+  printf("# %-6s %6s %6s %6s %10s %10s %8s %8s\n", "sink", "depth", "level", "hwm", "posted", "written", "full", "pool" );
+  for( sink=sink_data.sinks ; sink ; sink=sink->next ) {
+    struct sink_stats stats;
+    sink_stats( sink, &stats );
+    printf("# %-6s %6lu %6lu %6lu %10lu %10lu %8lu %8lu\n", sink->name,
+           stats.depth, stats.level, stats.hwm, stats.posted, stats.written,
+           stats.drop[SINK_DROP_FULL], stats.drop[SINK_DROP_POOL] );
+  }
+
+  return 0;
+}
+
+static void sink_register_cmd( void ) {
+  const esp_console_cmd_t cmd = {
+    .command = "sinks",
+    .help = "Show output sink queues and drops, 'sinks reset' to clear",
+    .hint = NULL,
+    .func = &sink_cmd,
+  };
+
+  ESP_ERROR_CHECK( esp_console_cmd_register( &cmd ) );
+}
+
+/*************************************************************************
+ * External API
+ */
+
+void sink_init( void ) {
+  uint16_t i;
+
+  esp_log_level_set( TAG, CONFIG_GWAY_LOG_LEVEL );
+
+  sink_data.free = xQueueCreate( SINK_MSGS, sizeof( struct sink_msg * ) );
+  for( i=0 ; i<SINK_MSGS ; i++ ) {
+    struct sink_msg *fmt = sink_data.pool + i;
+    fmt->pooled = 1;
+    xQueueSend( sink_data.free, &fmt, 0 );
+  }
+
+  sink_register_cmd();
+}
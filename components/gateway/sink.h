@@ -0,0 +1,103 @@
+/********************************************************************
+ * ramses_esp
+ * sink.h
+ *
+ * (C) 2025 Peter Price
+ *
+ * RX fan-out to output sinks
+ *
+ * Each RX message is formatted once into a reference counted
+ * struct sink_msg which is offered to every registered sink.
+ *
+ * Synchronous sinks copy what they need during post().
+ * Asynchronous sinks hold a reference on their own bounded queue and
+ * a worker task writes them out, so a slow transport only delays itself.
+ *
+ */
+#ifndef _SINK_H_
+#define _SINK_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "message.h"
+
+struct sink_msg {
+  _Atomic uint8_t refs;
+  uint8_t pooled;     // 0 for the fallback used when the pool is empty
+  uint8_t len;        // 0 if the message is not valid
+  char ts[MSG_TIMESTAMP];
+  char line[MSG_LINE_MAX];
+};
+
+#define SINK_DROP_LIST \
+  SINK_DROP( SINK_DROP_FULL, "full" )  /* Sink queue full */ \
+  SINK_DROP( SINK_DROP_POOL, "pool" )  /* No shared message to queue */ \
+
+#define SINK_DROP( _e, _t ) _e,
+enum sink_drop {
+  SINK_DROP_LIST
+  SINK_DROP_MAX
+};
+#undef SINK_DROP
+
+struct sink_stats {
+  uint32_t depth;   // 0 for synchronous sinks
+  uint32_t level;
+  uint32_t hwm;
+  uint32_t posted;
+  uint32_t written;
+  uint32_t drop[SINK_DROP_MAX];
+};
+
+struct sink;
+
+struct sink_ops {
+  // Called for every RX message from the gateway task, must not block.
+  // <msg> is only valid during the call.
+  void (*post)( struct sink *sink, struct sink_msg *fmt, struct message const *msg );
+
+  // Called when the gateway has nothing more to fan out, optional
+  void (*flush)( struct sink *sink );
+
+  // Asynchronous sinks, called from the sink's worker task
+  void (*write)( struct sink *sink, struct sink_msg *fmt );
+
+  // Asynchronous sinks that hold output back, optional.
+  // Called from the worker after each write and when the time it
+  // returned has passed. Returns how long the worker may wait.
+  TickType_t (*poll)( struct sink *sink );
+};
+
+struct sink {
+  char const *name;
+  struct sink_ops const *ops;
+
+  QueueHandle_t queue;
+  TaskHandle_t task;
+  uint32_t depth;
+
+  struct sink_stats stats;
+  struct sink *next;
+};
+
+extern uint8_t sink_msg_hold( struct sink_msg *fmt );
+extern void sink_msg_release( struct sink_msg *fmt );
+
+// post() of an asynchronous sink, queues a reference to <fmt>
+extern void sink_queue( struct sink *sink, struct sink_msg *fmt );
+
+extern void sink_register( struct sink *sink );
+extern void sink_start( struct sink *sink, uint32_t depth, UBaseType_t priority, BaseType_t coreID );
+
+// Gateway task
+extern void sink_fanout( struct message *msg );
+extern void sink_flush( void );
+
+extern void sink_init( void );
+
+#endif // _SINK_H_
@@ -31,21 +31,30 @@ enum msg_err_code { MSG_OK=0, _MSG_ERR_LIST MSG_ERR_MAX };
 /******************************************
 ** Frame interface
 */
-extern uint8_t *msg_rx_start(void);
+extern uint8_t *msg_rx_start( int64_t time );
 extern uint8_t msg_rx_byte(uint8_t byte);
 extern void msg_rx_end( uint8_t nBytes, uint8_t error );
 extern void msg_rx_rssi( uint8_t rssi );
 
 extern uint8_t msg_tx_byte(uint8_t *done);
 extern void msg_tx_end( uint8_t nBytes );
-extern void msg_tx_done(void);
+extern void msg_tx_done( int64_t time );
 
 /******************************************
 ** Application interface
 */
 struct message;
+
+// Message pool partitions
+enum msg_pool_class {
+  MSG_POOL_RX,     // Received frames
+  MSG_POOL_TX,     // TX lines from the host
+  MSG_POOL_GWAY,   // Messages generated by the gateway
+  MSG_POOL_MAX
+};
+
 extern void msg_free( struct message **msg );
-extern struct message *msg_alloc(void);
+extern struct message *msg_alloc( enum msg_pool_class cls );
 
 extern uint8_t msg_isValid( struct message *msg );
 extern uint8_t msg_isTx( struct message *msg );
@@ -53,16 +62,45 @@ extern uint8_t msg_isTx( struct message *msg );
 // RX messages
 extern void msg_rx_ready( struct message **msg );
 extern struct message *msg_rx_get(void);
-extern uint8_t msg_print( struct message *msg, char *msgBuff );
 extern void msg_change_addr( struct message *msg, uint8_t addr, uint8_t Class,uint32_t Id , uint8_t myClass,uint32_t myId );
-extern uint8_t msg_print_all( struct message *msg, char *msg_buff );
+extern uint16_t msg_format( struct message const *msg, char *buf, uint16_t size );
+
+// Buffer size that always holds a line from msg_format()
+#define MSG_LINE_MAX 180
+
+struct msg_bin_rx;
+extern void msg_bin_get( struct message const *msg, struct msg_bin_rx *rx );
 
 // TX Messages
 extern void msg_tx_ready( struct message **msg );
-extern uint8_t msg_scan( struct message *msg, uint8_t byte );
+extern uint8_t msg_parse( struct message *msg, char const *line, uint16_t len, uint16_t *errPos );
 extern void msg_change_addr( struct message *msg,uint8_t addr, uint8_t id,uint32_t class , uint8_t myId,uint32_t myClass );  
 
-extern char const *msg_get_ts( struct message const  *msg );
+// Structured TX
+enum msg_tx_type { MSG_TX_RQ, MSG_TX_I, MSG_TX_W, MSG_TX_RP };  // Same order as the frame header
+
+#define MSG_ADDR_NONE 0xFF   // Class of an absent address
+struct msg_addr {
+  uint8_t class;
+  uint32_t id;
+};
+
+struct msg_tx {
+  enum msg_tx_type type;
+  int16_t param;              // <0 if absent
+  struct msg_addr addr[3];
+  uint16_t opcode;
+  uint8_t len;
+  uint8_t const *payload;
+};
+
+extern uint8_t msg_tx_fields( struct message *msg, struct msg_tx const *tx );
+extern uint8_t msg_tx_frame( struct message *msg, uint8_t const *frame, uint8_t nBytes );
+
+// Buffer size for formatted timestamps
+#define MSG_TIMESTAMP 36
+extern char *msg_get_ts( struct message const *msg, char *ts, int len );
+extern int64_t msg_get_time( struct message const *msg );
 
 extern void msg_encode_address( uint8_t *addr, uint8_t  class, uint32_t  id );
 extern void msg_decode_address( uint8_t *addr, uint8_t *class, uint32_t *id );
@@ -80,6 +118,8 @@ extern void msg_1FC9_request_tx( uint32_t devAddr, uint8_t len, uint8_t *payload
 extern void msg_1FC9_reply_rx( struct message *msg );
 extern void msg_1FC9_ack_tx( uint32_t devAddr, uint32_t ctlAddr, uint8_t len, uint8_t *payload );
 
+extern void msg_register(void);
+
 extern void msg_init(void);
 extern void msg_work(void);
 
@@ -0,0 +1,97 @@
+/********************************************************************
+ * ramses_esp
+ * msg_bin.h
+ *
+ * (C) 2025 Peter Price
+ *
+ * Binary serial protocol
+ *
+ * Records are COBS encoded and both preceded and terminated by a 0x00 byte
+ * so any console text in between is discarded as a bad record.
+ * Before encoding a record is
+ *   TYPE(1) SEQ(4) BODY(n) CRC(2)
+ * Multi-byte values are little endian.
+ * The CRC is CRC-16/CCITT-FALSE over TYPE, SEQ and BODY.
+ *
+ * This file and msg_bin.c have no ESP-IDF dependencies so hosts
+ * can use them to decode the stream.
+ *
+ */
+#ifndef _MSG_BIN_H_
+#define _MSG_BIN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum msg_bin_type {
+  MSG_BIN_RX     = 0x01,  // Gateway->Host: received or transmitted message
+  MSG_BIN_TX     = 0x02,  // Host->Gateway: frame bytes to transmit
+  MSG_BIN_CTRL   = 0x03,  // Host->Gateway: control
+  MSG_BIN_STATUS = 0x04,  // Gateway->Host: result of TX or CTRL, SEQ is that of the request
+};
+
+// MSG_BIN_CTRL body
+enum msg_bin_ctrl {
+  MSG_BIN_CTRL_TEXT = 0x00, // Return to text mode
+  MSG_BIN_CTRL_PING = 0x01,
+};
+
+// rxFields, which fields were received
+#define MSG_BIN_F_OPCODE 0x01
+#define MSG_BIN_F_LEN    0x02
+#define MSG_BIN_F_PARAM0 0x04
+#define MSG_BIN_F_PARAM1 0x08
+#define MSG_BIN_F_ADDR0  0x10
+#define MSG_BIN_F_ADDR1  0x20
+#define MSG_BIN_F_ADDR2  0x40
+#define MSG_BIN_F_RSSI   0x80
+
+// fields, the message type is in the low 2 bits: RQ, I, W, RP
+#define MSG_BIN_TYPE_MASK 0x03
+
+#define MSG_BIN_PAYLOAD 64
+#define MSG_BIN_RAW     162
+
+// Decoded MSG_BIN_RX body
+struct msg_bin_rx {
+  int64_t time;       // esp_timer uS when the sync word was seen
+  uint8_t rssi;
+  uint8_t rxFields;
+  uint8_t fields;
+  uint8_t error;      // enum msg_err_code
+  uint8_t addr[3][3]; // Encoded 3 byte form
+  uint8_t param[2];
+  uint8_t opcode[2];
+  uint8_t len;
+  uint8_t nPayload;
+  uint8_t payload[MSG_BIN_PAYLOAD];
+  uint8_t nRaw;       // Raw bytes are only sent with errored frames
+  uint8_t raw[MSG_BIN_RAW];
+};
+
+#define MSG_BIN_HDR  5  // TYPE + SEQ
+#define MSG_BIN_CRC  2
+#define MSG_BIN_RX_MAX ( MSG_BIN_HDR + 8+1+1+1+1+9+2+2+1 + 1+MSG_BIN_PAYLOAD + 1+MSG_BIN_RAW + MSG_BIN_CRC )
+
+// Worst case COBS encoding of <n> bytes plus the terminating 0x00
+#define MSG_BIN_COBS_MAX(_n) ( (_n) + (_n)/254 + 2 )
+
+// Largest encoded record, including both delimiters
+#define MSG_BIN_RECORD_MAX ( 1 + MSG_BIN_COBS_MAX( MSG_BIN_RX_MAX ) )
+
+extern uint16_t msg_bin_crc( uint8_t const *data, size_t n );
+
+extern size_t msg_bin_cobs_encode( uint8_t const *src, size_t n, uint8_t *dst );
+extern size_t msg_bin_cobs_decode( uint8_t const *src, size_t n, uint8_t *dst, size_t size );
+
+// Build a complete record, <body> may be NULL if <nBody> is 0
+// Returns the length of the COBS encoded record including its delimiters
+extern size_t msg_bin_record( uint8_t type, uint32_t seq, uint8_t const *body, size_t nBody, uint8_t *dst, size_t size );
+
+// Check a decoded record, returns the body length or -1
+extern int msg_bin_check( uint8_t const *rec, size_t n, uint8_t *type, uint32_t *seq );
+
+extern size_t msg_bin_pack_rx( struct msg_bin_rx const *rx, uint8_t *body, size_t size );
+extern int msg_bin_unpack_rx( uint8_t const *body, size_t n, struct msg_bin_rx *rx );
+
+#endif // _MSG_BIN_H_
@@ -13,9 +13,14 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <sys/time.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+
 static const char * TAG = "MSG";
 #include "esp_log.h"
 
@@ -24,6 +29,8 @@ static const char * TAG = "MSG";
 #include "frame.h"
 
 #include "msg.h"
+#include "msg_cmd.h"
+#include "msg_bin.h"
 
 #define TRACE(_t)     ( 0 )
 #define DEBUG_MSG(_i) do{}while(0)
@@ -34,375 +41,701 @@ static char const * const MsgType[MSG_TYPE_MAX] = { _MSG_TYPE_LIST };
 #undef _MSG_TYPE
 
 /********************************************************
-** Message lists
+** Message queues
+**
+** Messages pass between the radio core and the host core
+** through single-producer/single-consumer rings.
+** Only the producer writes tail so neither side has to disable interrupts.
+** The radio task may discard the oldest RX message as well as the
+** gateway consuming it so head is advanced with compare-and-swap.
 ********************************************************/
-struct msg_list {
-  struct message *in;
-  struct message *out;
+#if CONFIG_N_MSG <= 8
+  #define MSG_RING_SIZE 8
+#elif CONFIG_N_MSG <= 16
+  #define MSG_RING_SIZE 16
+#elif CONFIG_N_MSG <= 32
+  #define MSG_RING_SIZE 32
+#elif CONFIG_N_MSG <= 64
+  #define MSG_RING_SIZE 64
+#elif CONFIG_N_MSG <= 128
+  #define MSG_RING_SIZE 128
+#elif CONFIG_N_MSG <= 256
+  #define MSG_RING_SIZE 256
+#elif CONFIG_N_MSG <= 512
+  #define MSG_RING_SIZE 512
+#else
+  #define MSG_RING_SIZE 1024
+#endif
+#define MSG_RING_MASK ( MSG_RING_SIZE-1 )
+
+struct msg_ring {
+  _Atomic uint32_t head;    // Consumer
+  _Atomic uint32_t tail;    // Producer
+
+  // Producer statistics
+  uint32_t hwm;
+  uint32_t puts;
+  uint32_t full;
+  uint32_t drop;
+  uint32_t wakeFail;   // Consumer could not be told
+
+  struct message *slot[MSG_RING_SIZE];
 };
 
-static void msg_put( struct msg_list *list, struct message **ppMsg, uint8_t reset ) {
-  struct message *pMsg = NULL;
-  if( ppMsg && list ) {
-    uint32_t volatile register ilevel = XTOS_DISABLE_ALL_INTERRUPTS;
-    pMsg = (*ppMsg);
-    if( pMsg ) {
+static uint8_t msg_ring_put( struct msg_ring *ring, struct message **ppMsg ) {
+  uint8_t ok = 0;
 
-      if( reset )
-        msg_reset( pMsg );
+  if( ppMsg && (*ppMsg) ) {
+    uint32_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    uint32_t head = atomic_load_explicit( &ring->head, memory_order_acquire );
+    uint32_t level = tail - head;
 
-      pMsg->next = NULL;
-      pMsg->prev = list->in;
-      if( pMsg->prev )
-        ( pMsg->prev )->next = pMsg;
+    if( level < MSG_RING_SIZE ) {
+      ring->slot[ tail & MSG_RING_MASK ] = (*ppMsg);
+      atomic_store_explicit( &ring->tail, tail+1, memory_order_release );
 
-      list->in = pMsg;
-      if( !list->out )      // list was empty
-        list->out = pMsg;   // so this is the first message
+      if( level+1 > ring->hwm )
+        ring->hwm = level+1;
+      ring->puts++;
 
       (*ppMsg) = NULL;
+      ok = 1;
+    } else {
+      ring->full++;
     }
-    XTOS_RESTORE_INTLEVEL(ilevel);
   }
+
+  return ok;
 }
 
-static struct message *msg_get( struct msg_list *list ) {
-  struct message *pMsg = NULL;
-  if( list ) {
-    uint32_t volatile register ilevel = XTOS_DISABLE_ALL_INTERRUPTS;
-    pMsg = list->out;
+static struct message *msg_ring_get( struct msg_ring *ring ) {
+  struct message *pMsg;
 
-    if( pMsg ) {
-      list->out = pMsg->next;
-      if( !list->out )      // message was last in list
-        list->in = NULL;    // So list is empty
+  uint32_t head = atomic_load_explicit( &ring->head, memory_order_acquire );
+  do {
+    uint32_t tail = atomic_load_explicit( &ring->tail, memory_order_acquire );
+    if( head == tail )
+      return NULL;
 
-      pMsg->prev = pMsg->next = NULL;
+    pMsg = ring->slot[ head & MSG_RING_MASK ];
+  } while( !atomic_compare_exchange_weak_explicit( &ring->head, &head, head+1,
+                                                   memory_order_acq_rel, memory_order_acquire ) );
 
-      pMsg->state = S_START;
-    }
-    XTOS_RESTORE_INTLEVEL(ilevel);
-  }
+  pMsg->state = S_START;
 
   return pMsg;
 }
 
+static uint32_t msg_ring_level( struct msg_ring *ring ) {
+  uint32_t head = atomic_load_explicit( &ring->head, memory_order_acquire );
+  uint32_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+
+  return tail - head;
+}
+
+static void msg_ring_stats( struct msg_ring *ring, struct msg_queue_stats *stats ) {
+  uint32_t head = atomic_load_explicit( &ring->head, memory_order_relaxed );
+  uint32_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+
+  stats->capacity = MSG_RING_SIZE;
+  stats->level = tail - head;
+  stats->hwm   = ring->hwm;
+  stats->count = ring->puts;
+  stats->fail  = ring->full + ring->wakeFail;
+  stats->drop  = ring->drop;
+}
+
+static void msg_ring_stats_reset( struct msg_ring *ring ) {
+  ring->hwm  = 0;
+  ring->puts = 0;
+  ring->full = 0;
+  ring->drop = 0;
+  ring->wakeFail = 0;
+}
+
 /********************************************************
-** Message structure pool
+** Message stages
+**
+** Every message in use is in exactly one stage.
+** Each stage counts the messages currently in it so we can
+** see where messages pile up under load.
+** The level is updated by both cores, the other statistics
+** are only indicative.
 ********************************************************/
+static struct msg_stage_count {
+  _Atomic uint32_t level;
+  uint32_t hwm;
+  uint32_t count;
+} msg_stages[MSG_STAGE_MAX];
+
+static void msg_set_stage( struct message *msg, enum msg_stage stage ) {
+  if( msg->stage != stage ) {
+    if( msg->stage != MSG_ST_NONE )
+      atomic_fetch_sub_explicit( &msg_stages[msg->stage].level, 1, memory_order_relaxed );
+
+    if( stage != MSG_ST_NONE ) {
+      struct msg_stage_count *s = &msg_stages[stage];
+      uint32_t level = atomic_fetch_add_explicit( &s->level, 1, memory_order_relaxed ) + 1;
+      if( level > s->hwm )
+        s->hwm = level;
+      s->count++;
+    }
 
-static struct msg_list msg_pool;
-void msg_free( struct message **msg ) { msg_put( &msg_pool, msg, 1 ); }
-struct message *msg_alloc(void) {  return msg_get( &msg_pool); }
-
-static void msg_create_pool(void) {
-  static struct message MSG[CONFIG_N_MSG];
-  uint8_t i;
-  for( i=0 ; i<CONFIG_N_MSG ; i++ ) {
-    struct message *msg = &MSG[i];
-    msg_free( &msg );
+    msg->stage = stage;
   }
 }
 
 /********************************************************
-** Received Message list
+** Free lists
+**
+** Free lists are lock-free stacks of indices shared by both cores.
+** The top of stack holds an index and a tag that changes
+** on every update to avoid ABA problems.
+** The links are kept apart from the items so they cost
+** nothing while an item is in use.
 ********************************************************/
-static struct msg_list rx_list;
+#define MSG_NIL       0xFFFF
+#define MSG_TOP_INDEX 0x0000FFFF
+#define MSG_TOP_TAG   0x00010000
 
-void msg_rx_ready( struct message **msg ) {
-  msg_timestamp( (*msg)->timestamp, MSG_TIMESTAMP );
-  gateway_radio_rx( msg );
+struct msg_stack {
+  _Atomic uint32_t top;
+  uint16_t *next;
+};
+
+static void msg_stack_push( struct msg_stack *stack, uint16_t index ) {
+  uint32_t top = atomic_load_explicit( &stack->top, memory_order_relaxed );
+  uint32_t next;
+
+  do {
+    stack->next[index] = top & MSG_TOP_INDEX;
+    next = ( ( top + MSG_TOP_TAG ) & ~MSG_TOP_INDEX ) | index;
+  } while( !atomic_compare_exchange_weak_explicit( &stack->top, &top, next,
+                                                   memory_order_release, memory_order_relaxed ) );
 }
 
-struct message *msg_rx_get(void) { return msg_get( &rx_list ); }
+static uint16_t msg_stack_pop( struct msg_stack *stack ) {
+  uint32_t top = atomic_load_explicit( &stack->top, memory_order_acquire );
+  uint32_t next;
+  uint16_t index;
 
+  do {
+    index = top & MSG_TOP_INDEX;
+    if( index==MSG_NIL )
+      break;
+
+    next = ( ( top + MSG_TOP_TAG ) & ~MSG_TOP_INDEX ) | stack->next[index];
+  } while( !atomic_compare_exchange_weak_explicit( &stack->top, &top, next,
+                                                   memory_order_acquire, memory_order_acquire ) );
+
+  return index;
+}
 
 /********************************************************
-** Transmit Message list
+** Message structure pool
 ********************************************************/
-static struct msg_list tx_list;
+static struct message *msg_store;
+static uint16_t msg_link[CONFIG_N_MSG];
 
-void msg_tx_ready( struct message **msg ) { msg_put( &tx_list, msg, 0 ); }
+static struct msg_pool {
+  struct msg_stack free;
+  _Atomic uint32_t used;
 
-static struct message *msg_tx_get(void) {  return msg_get( &tx_list ); }
+  uint32_t hwm;
+  uint32_t allocs;
+  uint32_t fails;
+} msg_pool = { .free = { .top = MSG_NIL, .next = msg_link } };
+
+static void msg_pool_push( struct message *msg ) {
+  msg_stack_push( &msg_pool.free, (uint16_t)( msg - msg_store ) );
+}
+
+static struct message *msg_pool_pop( void ) {
+  uint16_t index = msg_stack_pop( &msg_pool.free );
+
+  return ( index!=MSG_NIL ) ? &msg_store[index] : NULL;
+}
 
 /********************************************************
-** Message Print
+** Raw frame buffers
+**
+** Only errored frames, and traced frames, keep their raw bytes
+** so these come from a separate small pool and are attached
+** to a message when needed.
+** The radio decodes into a working buffer of its own.
 ********************************************************/
-#define sprintf_P sprintf
-#define PSTR(_s) _s
+struct msg_raw {
+  uint8_t nBytes;
+  uint8_t data[MAX_RAW];
+};
 
-static uint8_t msg_print_rssi( char *str, uint8_t rssi, uint8_t valid ) {
-  uint8_t n = 0;
+static struct msg_raw *raw_store;
+static uint16_t raw_link[CONFIG_N_MSG_RAW];
 
-  if( valid ) {
-    n = sprintf(str, PSTR("%03u "), rssi );
-  } else {
-    n = sprintf(str, PSTR("--- "));
+static struct msg_raw_pool {
+  struct msg_stack free;
+  _Atomic uint32_t used;
+
+  uint32_t hwm;
+  uint32_t allocs;
+  uint32_t fails;
+} raw_pool = { .free = { .top = MSG_NIL, .next = raw_link } };
+
+uint8_t msg_raw_attach( struct message *msg, uint8_t const *raw, uint8_t nBytes ) {
+  uint16_t index;
+
+  if( msg->raw )
+    index = msg->raw - 1;
+  else
+    index = msg_stack_pop( &raw_pool.free );
+
+  if( index==MSG_NIL ) {
+    raw_pool.fails++;
+    return 0;
   }
 
-  return n;
+  if( !msg->raw ) {
+    uint32_t used = atomic_fetch_add_explicit( &raw_pool.used, 1, memory_order_relaxed ) + 1;
+    if( used > raw_pool.hwm )
+      raw_pool.hwm = used;
+    raw_pool.allocs++;
+    msg->raw = index + 1;
+  }
+
+  if( nBytes > MAX_RAW )
+    nBytes = MAX_RAW;
+  memcpy( raw_store[index].data, raw, nBytes );
+  raw_store[index].nBytes = nBytes;
+
+  return 1;
 }
 
-static uint8_t msg_print_type( char *str, uint8_t type ) {
-  uint8_t n = 0;
+void msg_raw_detach( struct message *msg ) {
+  if( msg->raw ) {
+    msg_stack_push( &raw_pool.free, msg->raw - 1 );
+    atomic_fetch_sub_explicit( &raw_pool.used, 1, memory_order_relaxed );
+    msg->raw = 0;
+  }
+}
 
- n = sprintf_P( str,PSTR("%2s "),MsgType[type] );
+uint8_t msg_raw_get( struct message const *msg, uint8_t const **raw ) {
+  uint8_t nBytes = 0;
 
-  return n;
+  if( msg->raw ) {
+    struct msg_raw *r = &raw_store[ msg->raw - 1 ];
+    if( raw ) (*raw) = r->data;
+    nBytes = r->nBytes;
+  }
+
+  return nBytes;
 }
 
-static uint8_t msg_print_addr( char *str, uint8_t *addr, uint8_t valid ) {
-  uint8_t n = 0;
+/********************************************************
+** Pool partitions
+**
+** RX frames, host TX lines and gateway generated messages
+** all come from the same pool.
+** TX and gateway messages have a number of messages reserved
+** so RX traffic cannot use up the whole pool.
+** A class may use its own reserve and any messages not reserved
+** for the other classes.
+**
+** The in-use count of every class is held in one atomic word
+** so the check and update is a single compare-and-swap.
+********************************************************/
+#if ( CONFIG_MSG_RESERVE_TX + CONFIG_MSG_RESERVE_GWAY ) >= CONFIG_N_MSG
+  #error "Message pool reserves leave no messages for RX"
+#endif
+
+#define MSG_CLASS_BITS  10
+#define MSG_CLASS_MASK  ( ( 1 << MSG_CLASS_BITS ) - 1 )
+#define MSG_CLASS_SHIFT(_c) ( (_c) * MSG_CLASS_BITS )
 
-  if( valid ) {
-    uint8_t class;
-    uint32_t id;
-	msg_decode_address( addr, &class,&id );
+static _Atomic uint32_t msg_class_used;
 
-    n = sprintf_P(str, PSTR("%02hu:%06lu "), class, id );
-  } else {
-    n = sprintf_P(str, PSTR("--:------ "));
-  }
+static struct msg_class {
+  uint32_t reserve;
+
+  uint32_t hwm;
+  uint32_t allocs;
+  uint32_t fails;
+  uint32_t drops;   // Discarded before reaching the host
+} msg_class[MSG_POOL_MAX] = {
+  [MSG_POOL_TX]   = { .reserve = CONFIG_MSG_RESERVE_TX },
+  [MSG_POOL_GWAY] = { .reserve = CONFIG_MSG_RESERVE_GWAY },
+};
 
-  return n;
+static inline uint32_t msg_class_level( uint32_t used, enum msg_pool_class cls ) {
+  return ( used >> MSG_CLASS_SHIFT(cls) ) & MSG_CLASS_MASK;
 }
 
-static uint8_t msg_print_param( char *str, uint8_t param, uint8_t valid ) {
-  uint8_t n = 0;
+static uint8_t msg_class_take( enum msg_pool_class cls ) {
+  struct msg_class *c = &msg_class[cls];
+  uint32_t used = atomic_load_explicit( &msg_class_used, memory_order_relaxed );
+  uint32_t next, level;
 
-  if( valid ) {
-    n = sprintf_P(str, PSTR("%03u "), param );
-  } else {
-    n = sprintf_P(str, PSTR("--- "));
-  }
+  do {
+    uint32_t need = 0;
+    enum msg_pool_class i;
+
+    next = used + ( 1 << MSG_CLASS_SHIFT(cls) );
+
+    // Every class still needs its full reserve
+    for( i=0 ; i<MSG_POOL_MAX ; i++ ) {
+      uint32_t l = msg_class_level( next, i );
+      need += ( l > msg_class[i].reserve ) ? l : msg_class[i].reserve;
+    }
+
+    if( need > CONFIG_N_MSG ) {
+      c->fails++;
+      return 0;
+    }
+  } while( !atomic_compare_exchange_weak_explicit( &msg_class_used, &used, next,
+                                                   memory_order_relaxed, memory_order_relaxed ) );
+
+  level = msg_class_level( next, cls );
+  if( level > c->hwm )
+    c->hwm = level;
+  c->allocs++;
 
-  return n;
+  return 1;
 }
 
-static uint8_t msg_print_opcode( char *str, uint8_t *opcode, uint8_t valid ) {
-  uint8_t n = 0;
+static void msg_class_give( enum msg_pool_class cls ) {
+  atomic_fetch_sub_explicit( &msg_class_used, 1 << MSG_CLASS_SHIFT(cls), memory_order_relaxed );
+}
 
-  if( valid ) {
-    n = sprintf_P( str, PSTR("%02X%02X "), opcode[0],opcode[1] );
-  } else {
-    n= sprintf_P(str, PSTR("???? "));
+void msg_class_stats( enum msg_pool_class cls, struct msg_class_stats *stats ) {
+  memset( stats, 0, sizeof(*stats) );
+
+  if( cls < MSG_POOL_MAX ) {
+    struct msg_class *c = &msg_class[cls];
+    uint32_t used = atomic_load_explicit( &msg_class_used, memory_order_relaxed );
+    enum msg_pool_class i;
+
+    // Everything not reserved for the other classes
+    stats->limit = CONFIG_N_MSG;
+    for( i=0 ; i<MSG_POOL_MAX ; i++ ) {
+      if( i != cls )
+        stats->limit -= msg_class[i].reserve;
+    }
+
+    stats->reserve = c->reserve;
+    stats->level   = msg_class_level( used, cls );
+    stats->hwm     = c->hwm;
+    stats->count   = c->allocs;
+    stats->fail    = c->fails;
+    stats->drop    = c->drops;
+  }
+}
+
+void msg_class_stats_reset( void ) {
+  uint32_t used = atomic_load_explicit( &msg_class_used, memory_order_relaxed );
+  enum msg_pool_class cls;
+
+  for( cls=0 ; cls<MSG_POOL_MAX ; cls++ ) {
+    struct msg_class *c = &msg_class[cls];
+    c->hwm    = msg_class_level( used, cls );
+    c->allocs = 0;
+    c->fails  = 0;
+    c->drops  = 0;
   }
+}
+
+void msg_free( struct message **msg ) {
+  if( msg && (*msg) ) {
+    enum msg_pool_class cls = (*msg)->pool;
+
+    msg_set_stage( *msg, MSG_ST_NONE );
+    msg_raw_detach( *msg );
+    msg_reset( *msg );
+    msg_pool_push( *msg );
+    atomic_fetch_sub_explicit( &msg_pool.used, 1, memory_order_relaxed );
 
-  return n;
+    // Only release the class once the message is back in the pool
+    msg_class_give( cls );
+    (*msg) = NULL;
+  }
 }
 
-static uint8_t msg_print_len( char *str, uint8_t len, uint8_t valid ) {
-  uint8_t n = 0;
+struct message *msg_alloc( enum msg_pool_class cls ) {
+  struct message *msg = NULL;
+
+  if( cls < MSG_POOL_MAX && msg_class_take( cls ) ) {
+    msg = msg_pool_pop();
+    if( !msg )
+      msg_class_give( cls );
+  }
+
+  if( msg ) {
+    uint32_t used = atomic_fetch_add_explicit( &msg_pool.used, 1, memory_order_relaxed ) + 1;
+    if( used > msg_pool.hwm )
+      msg_pool.hwm = used;
+    msg_pool.allocs++;
 
-  if( valid ) {
-    n = sprintf_P(str, PSTR("%03u "), len );
+    msg->pool = cls;
+    msg->state = S_START;
+    msg_set_stage( msg, MSG_ST_HOST );
   } else {
-    n = sprintf_P(str, PSTR("??? "));
+    msg_pool.fails++;
   }
 
-  return n;
+  return msg;
 }
 
-static uint8_t msg_print_payload( char *str, uint8_t payload ) {
-  uint8_t n=0;
+static void *msg_pool_calloc( size_t n, size_t size ) {
+  void *store = NULL;
 
-  n = sprintf_P( str,PSTR("%02X"),payload );
+#if defined(CONFIG_MSG_POOL_PSRAM)
+  store = heap_caps_calloc( n, size, MALLOC_CAP_SPIRAM|MALLOC_CAP_8BIT );
+#endif
+  if( !store )
+    store = heap_caps_calloc( n, size, MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT );
 
-  return n;
+  return store;
 }
 
-static char const *msg_error_str( uint8_t error )
-{
-  static char const msg_err_OK[] = "OK" ;
-  static char const msg_err_UNKNOWN[] = "UNKNOWN" ;
-#define _MSG_ERR(_e,_t) static char const msg_err_ ## _e[] = _t ;
-  _MSG_ERR_LIST
-#undef _MSG_ERR
-#define _MSG_ERR(_e,_t) , msg_err_ ## _e
-  static char const *const msg_err[MSG_ERR_MAX+1] = { msg_err_OK _MSG_ERR_LIST, msg_err_UNKNOWN };
-#undef _MSG_ERR
+static void msg_create_pool(void) {
+  uint16_t i;
 
-  char const * str = "ERROR";
-  if( error>MSG_ERR_MAX ) error = MSG_ERR_MAX;
-  str = msg_err[error];
+  msg_store = msg_pool_calloc( CONFIG_N_MSG, sizeof(struct message) );
+  raw_store = msg_pool_calloc( CONFIG_N_MSG_RAW, sizeof(struct msg_raw) );
+  if( !msg_store || !raw_store ) {
+    ESP_LOGE( TAG, "No memory for %d messages", CONFIG_N_MSG );
+    return;
+  }
 
- return str;
+  for( i=0 ; i<CONFIG_N_MSG ; i++ ) {
+    struct message *msg = &msg_store[i];
+    msg_reset( msg );
+    msg_pool_push( msg );
+  }
+
+  for( i=0 ; i<CONFIG_N_MSG_RAW ; i++ )
+    msg_stack_push( &raw_pool.free, i );
 }
 
-static uint8_t msg_print_error( char *str, uint8_t error ) {
-  uint8_t n = 0;
+/********************************************************
+** Received Message list
+**
+** Produced by the radio task, consumed by the gateway.
+**
+** The radio task must never wait for the gateway so when
+** the host falls behind frames are dropped:
+**  - once the list is half full errored frames are discarded,
+**    the gateway would not print them anyway
+**  - CONFIG_MSG_RX_DROP_OLDEST recycles the oldest waiting frame
+**    when the pool is empty, see msg_rx_start().
+**    Only a received frame is recycled, never a TX echo.
+**    Otherwise the new frame is lost.
+**    The list has a slot for every message so it never fills.
+********************************************************/
+static struct msg_ring rx_list;
+
+#define MSG_RX_PRESSURE ( MSG_RING_SIZE/2 )
 
-  return n;
+static void msg_rx_discard( struct message **msg ) {
+  msg_class[ (*msg)->pool ].drops++;
+  msg_free( msg );
 }
 
-static uint8_t msg_print_raw( char *str, uint8_t raw, uint8_t i ) {
-  uint8_t n = 0;
+#if defined(CONFIG_MSG_RX_DROP_OLDEST)
+// Discard the oldest message waiting for the gateway if it is a received frame.
+// Anything else would not free an RX message.
+static uint8_t msg_rx_drop_oldest( void ) {
+  struct message *msg;
 
-  return n;
-}
+  uint32_t head = atomic_load_explicit( &rx_list.head, memory_order_acquire );
+  do {
+    uint32_t tail = atomic_load_explicit( &rx_list.tail, memory_order_acquire );
+    if( head == tail )
+      return 0;
+
+    // If the gateway takes it first the exchange fails and we look again
+    msg = rx_list.slot[ head & MSG_RING_MASK ];
+    if( msg->pool != MSG_POOL_RX )
+      return 0;
+  } while( !atomic_compare_exchange_weak_explicit( &rx_list.head, &head, head+1,
+                                                   memory_order_acq_rel, memory_order_acquire ) );
 
-static uint8_t msg_print_bytes( char *str, uint8_t raw, uint8_t i ) {
-  uint8_t n = 0;
+  rx_list.drop++;
+  msg_rx_discard( &msg );
 
-  return n;
+  return 1;
 }
+#endif
 
-/************************************************************************************
-**
-** msg_print_field
-**
-** get the next buffer of output text
-**/
+void msg_rx_ready( struct message **msg ) {
+  uint32_t level = msg_ring_level( &rx_list );
 
-static uint8_t msg_print_field( struct message *msg, char *buff ) {
-  uint8_t nBytes = 0;
+  if( level >= MSG_RX_PRESSURE && !msg_isValid( *msg ) ) {
+    rx_list.drop++;
+    msg_rx_discard( msg );
+    return;
+  }
 
-  switch( msg->state ) {
-  case S_START:
-    nBytes = msg_print_rssi( buff, msg->rssi, msg->rxFields&F_RSSI );
-    msg->state = S_HEADER;
-    if( nBytes )
-      break;
-    /* fallthrough */
+  // The gateway may take the message as soon as it's in the list
+  msg_set_stage( *msg, MSG_ST_GWAY );
+  if( !msg_ring_put( &rx_list, msg ) )
+    msg_rx_discard( msg );
 
-  case S_HEADER:
-    nBytes = msg_print_type( buff, msg->fields & F_MASK );
-    msg->state = S_PARAM0;
-    if( nBytes )
-      break;
-    /* fallthrough */
+  // The gateway also checks the list when it has been idle for a tick
+  if( !gateway_radio_rx() )
+    rx_list.wakeFail++;
+}
 
-  case S_PARAM0:
-    nBytes = msg_print_param( buff, msg->param[0], msg->rxFields&F_PARAM0 );
-    msg->state = S_ADDR0;
-    if( nBytes )
-      break;
-    /* fallthrough */
+struct message *msg_rx_get(void) {
+  struct message *msg = msg_ring_get( &rx_list );
+  if( msg )
+    msg_set_stage( msg, MSG_ST_HOST );
 
-  case S_ADDR0:
-    nBytes = msg_print_addr( buff, msg->addr[0], msg->rxFields&F_ADDR0 );
-    msg->state = S_ADDR1;
-    if( nBytes )
-      break;
-    /* fallthrough */
+  return msg;
+}
 
-  case S_ADDR1:
-    nBytes = msg_print_addr( buff, msg->addr[1], msg->rxFields&F_ADDR1 );
-    msg->state = S_ADDR2;
-    if( nBytes )
-      break;
-    /* fallthrough */
 
-  case S_ADDR2:
-    nBytes = msg_print_addr( buff, msg->addr[2], msg->rxFields&F_ADDR2 );
-    msg->state = S_OPCODE;
-    if( nBytes )
-      break;
-    /* fallthrough */
+/********************************************************
+** Transmit Message list
+**
+** Produced by host tasks, consumed by the radio task.
+** There may be several host tasks so they are serialised
+** by a mutex, the radio task never takes it.
+********************************************************/
+static struct msg_ring tx_list;
+static SemaphoreHandle_t tx_lock;
 
-  case S_OPCODE:
-    nBytes = msg_print_opcode( buff, msg->opcode, msg->rxFields&F_OPCODE );
-    msg->state = S_LEN;
-    if( nBytes )
-      break;
-    /* fallthrough */
+void msg_tx_ready( struct message **msg ) {
+  uint8_t ok;
 
-  case S_LEN:
-    nBytes = msg_print_len( buff, msg->len, msg->rxFields&F_LEN );
-    msg->state = S_PAYLOAD;
-    if( nBytes )
-      break;
-    /* fallthrough */
-
-  case S_PAYLOAD:
-    // Multi buffer field
-    if( msg->count < msg->nPayload ) {
-      nBytes = msg_print_payload( buff, msg->payload[msg->count++] );
-      if( nBytes )
-        break;
-    }
+  if( msg && (*msg) )
+    msg_set_stage( *msg, MSG_ST_TX );
 
-    msg->count = 0;
-    msg->state = S_ERROR;
-    /* fallthrough */
+  if( tx_lock ) xSemaphoreTake( tx_lock, portMAX_DELAY );
+  ok = msg_ring_put( &tx_list, msg );
+  if( tx_lock ) xSemaphoreGive( tx_lock );
 
-  case S_ERROR:
-    nBytes = msg_print_error( buff, msg->error );
-    msg->state = S_TRAILER;
-    if( nBytes )
-      break;
-    /* fallthrough */
-
-  case S_TRAILER:   // Don't print trailer, use state for raw data
-    // Multi buffer field
-    if( msg->error || TRACE(TRC_RAW) ){
-      if( msg->count < msg->nBytes ) {
-        if( msg->rxFields&F_RSSI )
-          nBytes = msg_print_raw( buff, msg->raw[msg->count], msg->count );
-        else
-          nBytes = msg_print_bytes( buff, msg->raw[msg->count], msg->count );
-        msg->count++;
-      } else if( msg->nBytes ) {
-//        nBytes = sprintf_P( buff, PSTR("\r\n") );
-        msg->state = S_COMPLETE;
-      }
-      if( nBytes )
-        break;
-    }
+  if( ok ) {
+    frame_wake();
+  } else {
+    ESP_LOGW( TAG, "TX list full" );
+    msg_free( msg );
+  }
+}
 
-    msg->count = 0;
-    msg->state = S_COMPLETE;
-    /* fallthrough */
+static struct message *msg_tx_get(void) {  return msg_ring_get( &tx_list ); }
 
-  case S_COMPLETE:
+/********************************************************
+** Queue statistics
+********************************************************/
+void msg_queue_stats( enum msg_queue q, struct msg_queue_stats *stats ) {
+  memset( stats, 0, sizeof(*stats) );
+
+  switch( q ) {
+  case MSG_Q_POOL:
+    stats->capacity = CONFIG_N_MSG;
+    stats->level = atomic_load_explicit( &msg_pool.used, memory_order_relaxed );
+    stats->hwm   = msg_pool.hwm;
+    stats->count = msg_pool.allocs;
+    stats->fail  = msg_pool.fails;
+    break;
+  case MSG_Q_RAW:
+    stats->capacity = CONFIG_N_MSG_RAW;
+    stats->level = atomic_load_explicit( &raw_pool.used, memory_order_relaxed );
+    stats->hwm   = raw_pool.hwm;
+    stats->count = raw_pool.allocs;
+    stats->fail  = raw_pool.fails;
     break;
+  case MSG_Q_TX:  msg_ring_stats( &tx_list, stats );  break;
+  case MSG_Q_RX:  msg_ring_stats( &rx_list, stats );  break;
+  default: break;
   }
-
-  return nBytes;
 }
 
-/************************************************************************************
-**
-** msg_print
-**
-** Called repeatedly from msg_work.
-** Neither this function or any it calls must block or delay
-**
-** Acquires a buffer of output and tries to send it to the serial port
-** If it's not transferred this time, try again until it goes.
-**
-** Keep getting more buffers until we get a zero length buffer
-**
-** We can re-use some of the working fields from struct message to control
-** progress
-**/
+void msg_queue_stats_reset( void ) {
+  msg_pool.hwm    = atomic_load_explicit( &msg_pool.used, memory_order_relaxed );
+  msg_pool.allocs = 0;
+  msg_pool.fails  = 0;
 
-uint8_t msg_print( struct message *msg, char *msg_buff ) {
-  uint8_t n;
+  raw_pool.hwm    = atomic_load_explicit( &raw_pool.used, memory_order_relaxed );
+  raw_pool.allocs = 0;
+  raw_pool.fails  = 0;
 
-  if( msg->state == S_START ) {
-    DEBUG_MSG(1);
-    msg->count = 0;
-  }
+  msg_ring_stats_reset( &tx_list );
+  msg_ring_stats_reset( &rx_list );
+}
 
-  n = msg_print_field( msg, msg_buff );
+void msg_stage_stats( enum msg_stage stage, struct msg_queue_stats *stats ) {
+  memset( stats, 0, sizeof(*stats) );
 
-  if( msg->state == S_COMPLETE )
-    DEBUG_MSG(0);
+  if( stage>MSG_ST_NONE && stage<MSG_STAGE_MAX ) {
+    struct msg_stage_count *s = &msg_stages[stage];
+    stats->capacity = CONFIG_N_MSG;
+    stats->level = atomic_load_explicit( &s->level, memory_order_relaxed );
+    stats->hwm   = s->hwm;
+    stats->count = s->count;
+  }
+}
 
-  return n;
+void msg_stage_stats_reset( void ) {
+  enum msg_stage stage;
+
+  for( stage=MSG_ST_NONE+1 ; stage<MSG_STAGE_MAX ; stage++ ) {
+    struct msg_stage_count *s = &msg_stages[stage];
+    s->hwm   = atomic_load_explicit( &s->level, memory_order_relaxed );
+    s->count = 0;
+  }
 }
 
-uint8_t msg_print_all( struct message *msg, char *msg_buff ) {
-  uint8_t len = 0;
+/********************************************************
+** Error text
+********************************************************/
+static char const *msg_error_str( uint8_t error )
+{
+  static char const msg_err_OK[] = "OK" ;
+  static char const msg_err_UNKNOWN[] = "UNKNOWN" ;
+#define _MSG_ERR(_e,_t) static char const msg_err_ ## _e[] = _t ;
+  _MSG_ERR_LIST
+#undef _MSG_ERR
+#define _MSG_ERR(_e,_t) , msg_err_ ## _e
+  static char const *const msg_err[MSG_ERR_MAX+1] = { msg_err_OK _MSG_ERR_LIST, msg_err_UNKNOWN };
+#undef _MSG_ERR
 
-  msg->state = S_START;
-  do {
-    len += msg_print( msg, msg_buff+len );
-  } while( msg->state != S_COMPLETE );
+  char const * str = "ERROR";
+  if( error>MSG_ERR_MAX ) error = MSG_ERR_MAX;
+  str = msg_err[error];
 
-  return len;
+ return str;
+}
+
+/************************************************************************************
+**
+** msg_bin_get
+**
+** Fill the binary protocol view of a message
+**/
+_Static_assert( MSG_BIN_F_RSSI==F_RSSI && MSG_BIN_F_ADDR0==F_ADDR0 && MSG_BIN_F_PARAM0==F_PARAM0
+             && MSG_BIN_F_OPCODE==F_OPCODE && MSG_BIN_F_LEN==F_LEN, "Binary field flags" );
+_Static_assert( MSG_BIN_PAYLOAD==MAX_PAYLOAD && MSG_BIN_RAW==MAX_RAW, "Binary field sizes" );
+
+void msg_bin_get( struct message const *msg, struct msg_bin_rx *rx ) {
+  uint8_t const *raw;
+
+  rx->time     = msg->time;
+  rx->rssi     = msg->rssi;
+  rx->rxFields = msg->rxFields;
+  rx->fields   = msg->fields;
+  rx->error    = msg->error;
+
+  memcpy( rx->addr, msg->addr, sizeof(rx->addr) );
+  memcpy( rx->param, msg->param, sizeof(rx->param) );
+  memcpy( rx->opcode, msg->opcode, sizeof(rx->opcode) );
+  rx->len = msg->len;
+
+  rx->nPayload = msg->nPayload;
+  memcpy( rx->payload, msg->payload, msg->nPayload );
+
+  rx->nRaw = msg_raw_get( msg, &raw );
+  if( rx->nRaw )
+    memcpy( rx->raw, raw, rx->nRaw );
 }
 
 /********************************************************
@@ -497,6 +830,7 @@ static uint8_t msg_rx_checksum( struct message *msg, uint8_t byte __attribute__(
 }
 
 static struct message *msgRx;
+static uint8_t rxRaw[MAX_RAW];   // Radio working buffer
 static void msg_rx_process(uint8_t byte) {
   msgRx->csum += byte;
   ESP_LOGD( TAG, "byte=%02x",byte );
@@ -523,13 +857,20 @@ void msg_rx_rssi( uint8_t rssi ) {
   ESP_LOGI( TAG, "rssi=%03d",rssi );
 }
 
-uint8_t *msg_rx_start(void) {
+uint8_t *msg_rx_start( int64_t time ) {
   uint8_t *raw = NULL;
   DEBUG_MSG(1);
 
-  msgRx = msg_alloc();
+  msgRx = msg_alloc( MSG_POOL_RX );
+#if defined(CONFIG_MSG_RX_DROP_OLDEST)
+  // At most one frame is given up for each new one
+  if( !msgRx && msg_rx_drop_oldest() )
+    msgRx = msg_alloc( MSG_POOL_RX );
+#endif
   if( msgRx ) {
-    raw = msgRx->raw;
+    msg_set_stage( msgRx, MSG_ST_RX );
+    msgRx->time = time;
+    raw = rxRaw;
     raw[0] = MAX_RAW;
   }
 
@@ -553,8 +894,6 @@ uint8_t msg_rx_byte( uint8_t byte ) {
 void msg_rx_end( uint8_t nBytes, uint8_t error ) {
   DEBUG_MSG(1);
 
-  msgRx->nBytes = nBytes;
-
   if( error==MSG_OK ) {
     // All optional fields received as expected?
     if(   ( ( msgRx->rxFields & F_OPTION ) != ( msgRx->fields & F_OPTION ) )
@@ -567,33 +906,26 @@ void msg_rx_end( uint8_t nBytes, uint8_t error ) {
   ESP_LOGI( TAG, "END[%d] (%s)",nBytes,msg_error_str(error) );
 
   msgRx->error = error;
+  if( error || TRACE(TRC_RAW) )
+    msg_raw_attach( msgRx, rxRaw, nBytes );
   msg_rx_ready( &msgRx );
 
   DEBUG_MSG(0);
 }
 
 /********************************************************
-** TX Message scan
+** TX Message parse
+**
+** Parse a complete HGI80 TX line
+**   TYPE PARAM0 ADDR0 ADDR1 ADDR2 OPCODE LEN PAYLOAD
+** Fields are separated by one or more spaces.
+** Absent PARAM0 and address fields start with '-'.
+** Payload bytes are two hex digits, spaces between them are allowed.
+** The line ends at the first CR, LF or NUL.
+**
+** There's no state outside the message so any task may
+** parse a line at any time.
 ********************************************************/
-static uint8_t msg_scan_header( struct message *msg, char *str, uint8_t nChar ) {
-  uint8_t ok = 0;
-  uint8_t msgType;
-
-  // Cheap conversion to upper for acceptable characters
-  while( --nChar )
-    str[ nChar-1 ] &= ~( 'A'^'a' );
-
-  for( msgType=F_RQ ; msgType<=F_RP ; msgType++ ) {
-    if( 0==strcmp( str, MsgType[msgType] ) ) {
-      msg->fields = msgType;
-	  ok = 1;
-      break;
-    }
-  }
-
-  return ok;
-}
-
 void msg_change_addr( struct message *msg, uint8_t addr, uint8_t Class,uint32_t Id , uint8_t myClass,uint32_t myId ) {
   if( msg && ( msg->fields & ( F_ADDR0 << addr ) ) ) { // Message contains specified address field
     uint8_t *Addr = msg->addr[addr];
@@ -606,172 +938,188 @@ void msg_change_addr( struct message *msg, uint8_t addr, uint8_t Class,uint32_t
   }
 }
 
-static uint8_t msg_scan_addr( struct message *msg, char *str, uint8_t nChar ) {
-  uint8_t ok = 0;
-  uint8_t addr = msg->state - S_ADDR0;
+struct msg_parser {
+  char const *line;
+  char const *p;      // Start of current field
+  char const *q;      // End of current field
+  char const *end;
+};
 
-  if( str[0]!='-' ) {
-    uint8_t class;
-    uint32_t id;
+static inline uint8_t parse_hex( char c ) {
+  if( c>='0' && c<='9' ) return c - '0';
+  c |= 'a'^'A';
+  if( c>='a' && c<='f' ) return c - 'a' + 10;
+  return 0xFF;
+}
 
-  	if( nChar<11 && 2==sscanf( str, "%hhu:%lu", &class, &id ) ) {
-	  msg_encode_address( msg->addr[addr], class, id );
-      msg->fields |= F_ADDR0 << addr;
-      ok = 1;
-    } 
-  } else {
-    ok = 1;
+// Decimal value of [p,q), at most <digits> digits
+static uint8_t parse_dec( char const *p, char const *q, uint8_t digits, uint32_t *value ) {
+  uint32_t v = 0;
+
+  if( p==q || q-p > digits )
+    return 0;
+
+  while( p<q ) {
+    if( *p<'0' || *p>'9' )
+      return 0;
+    v = v*10 + ( *(p++) - '0' );
   }
 
-  return ok;
+  (*value) = v;
+  return 1;
 }
 
-static uint8_t msg_scan_param( struct message *msg, char *str, uint8_t nChar ) {
-  uint8_t ok = 0;
-  uint8_t param = msg->state - S_PARAM0;
+// Find the next field
+static uint8_t parse_field( struct msg_parser *ps ) {
+  char const *p = ps->q;
 
-  if( str[0]!='-' ) {
-  	if( nChar<5 && 1==sscanf( str, "%hhu", msg->param+param ) ) {
-      msg->fields |= F_PARAM0 << param;
-      ok = 1;
-    } 
-  } else {
-    ok = 1;
-  }
+  while( p<ps->end && *p==' ' )
+    p++;
+  ps->p = p;
 
-  return ok;
+  while( p<ps->end && *p!=' ' )
+    p++;
+  ps->q = p;
+
+  return ps->p < ps->q;
 }
 
-static uint8_t msg_scan_opcode( struct message *msg, char *str, uint8_t nChar ) {
-  uint8_t ok = 0;
+static uint8_t parse_type( struct message *msg, struct msg_parser *ps ) {
+  uint8_t type;
 
-  if( nChar==5 && 2==sscanf( str, "%02hhx%02hhx", msg->opcode+0,msg->opcode+1 )  ) {
-    msg->rxFields |= F_OPCODE;
-    ok = 1;
+  for( type=F_RQ ; type<=F_RP ; type++ ) {
+    char const *t = MsgType[type];
+    char const *p = ps->p;
+
+    while( *t && p<ps->q && ( *p & ~( 'A'^'a' ) )==*t ) {
+      p++;
+      t++;
+    }
+
+    if( !*t && p==ps->q ) {
+      msg->fields = type;
+      return 1;
+    }
   }
 
-  return ok;
+  return 0;
 }
 
-static uint8_t msg_scan_len( struct message *msg, char *str, uint8_t nChar ) {
-  uint8_t ok = 0;
+static uint8_t parse_param( struct message *msg, struct msg_parser *ps, uint8_t param ) {
+  uint32_t value;
 
-  if( nChar<5 && 1==sscanf( str, "%hhu", &msg->len ) ) {
-    if( msg->len > 0 && msg->len <= MAX_PAYLOAD )
-    {
-      msg->rxFields |= F_LEN;
-      ok = 1;
-    }
-  } 
+  if( *ps->p=='-' )
+    return 1;
 
-  return ok;
+  if( !parse_dec( ps->p, ps->q, 3, &value ) || value>0xFF )
+    return 0;
+
+  msg->param[param] = value;
+  msg->fields |= F_PARAM0 << param;
+  return 1;
 }
 
-static uint8_t msg_scan_payload( struct message *msg, char *str, uint8_t nChar ) {
-  uint8_t ok=0;
-  
-  if( nChar==3 && 1==sscanf( str, "%02hhx", msg->payload+msg->nPayload ) )
-  {
-    msg->nPayload++;
-	ok = 1;
-  }
+static uint8_t parse_addr( struct message *msg, struct msg_parser *ps, uint8_t addr ) {
+  char const *colon = ps->p;
+  uint32_t class, id;
 
-  return ok;
+  if( *ps->p=='-' )
+    return 1;
+
+  while( colon<ps->q && *colon!=':' )
+    colon++;
+
+  if( colon==ps->q )
+    return 0;
+  if( !parse_dec( ps->p, colon, 2, &class ) || class>0x3F )
+    return 0;
+  if( !parse_dec( colon+1, ps->q, 6, &id ) || id>0x3FFFF )
+    return 0;
+
+  msg_encode_address( msg->addr[addr], class, id );
+  msg->fields |= F_ADDR0 << addr;
+  return 1;
 }
 
-uint8_t msg_scan( struct message *msg, uint8_t byte ) {
-  static char field[17];
-  static uint8_t nChar=0;
-  uint8_t ok = 1;
+static uint8_t parse_opcode( struct message *msg, struct msg_parser *ps ) {
+  uint8_t i;
 
-  if( byte=='\n' ) return 0; // Discard newline
+  if( ps->q - ps->p != 4 )
+    return 0;
 
-  if( byte=='\r' ) {
-    // Ignore blank line
-    if( msg->state==S_START && nChar==0 )
+  for( i=0 ; i<2 ; i++ ) {
+    uint8_t hi = parse_hex( ps->p[2*i] );
+    uint8_t lo = parse_hex( ps->p[2*i+1] );
+    if( ( hi|lo ) & 0xF0 )
       return 0;
-
-    // Didn't get a sensible message
-    if( msg->state != S_CHECKSUM ) {
-      nChar = 0;
-      msg->rxFields |= msg->fields;
-	  msg->error = MSG_BAD_TX;
-      return 1;
-    } else {
-      byte = '\0';
-    }
+    msg->opcode[i] = ( hi<<4 ) | lo;
   }
 
-  if( msg->nBytes<MAX_RAW )
-    msg->raw[msg->nBytes++] = byte;
+  msg->rxFields |= F_OPCODE;
+  return 1;
+}
+
+static uint8_t parse_len( struct message *msg, struct msg_parser *ps ) {
+  uint32_t len;
 
-  // Discard to end of line
-  if( msg->state == S_ERROR )
+  if( !parse_dec( ps->p, ps->q, 3, &len ) || len==0 || len>MAX_PAYLOAD )
     return 0;
 
-  if( byte==' ' ) {
-    // Discard leading spaces
-    if( nChar==0 )
-      return 0;
+  msg->len = len;
+  msg->rxFields |= F_LEN;
+  return 1;
+}
 
-    // Terminate field
-    byte = '\0';
-  }
-  field[ nChar++ ] = (char)byte;
+// Payload bytes may be separated by spaces but a byte may not be split
+static uint8_t parse_payload( struct message *msg, struct msg_parser *ps ) {
+  char const *p = ps->p;
 
-  // No spaces between PAYLOAD bytes
-  if( byte && msg->state == S_PAYLOAD ) {
-    if( nChar==2 ) {
-      field[nChar++] = '\0';
+  while( msg->nPayload < msg->len ) {
+    uint8_t hi, lo;
 
-      ok = msg_scan_payload( msg, field, nChar );
-      if( ok ) {
-        nChar = 0;
-        if( msg->nPayload == msg->len ) {
-          msg->state = S_CHECKSUM;
-        }
-      }
+    while( p<ps->end && *p==' ' )
+      p++;
+    if( ps->end - p < 2 )
+      break;
 
-    } else { // wait for second byte
-      return 0;
-    }
-  }
+    hi = parse_hex( p[0] );
+    lo = parse_hex( p[1] );
+    if( ( hi|lo ) & 0xF0 )
+      break;
 
-  if( !byte ) {
-    switch( msg->state ) {
-    case S_START: /* fall through */
-    case S_HEADER:      ok=msg_scan_header( msg, field, nChar ); msg->state = S_PARAM0;   break;
-    case S_ADDR0:       ok=msg_scan_addr( msg, field, nChar );   msg->state = S_ADDR1;    break;
-    case S_ADDR1:       ok=msg_scan_addr( msg, field, nChar );   msg->state = S_ADDR2;    break;
-    case S_ADDR2:       ok=msg_scan_addr( msg, field, nChar );   msg->state = S_OPCODE;   break;
-    case S_PARAM0:      ok=msg_scan_param( msg, field, nChar );  msg->state = S_ADDR0;    break;
-//    case S_PARAM1:
-    case S_OPCODE:      ok=msg_scan_opcode( msg, field, nChar ); msg->state = S_LEN;      break;
-    case S_LEN:         ok=msg_scan_len( msg, field, nChar );    msg->state = S_PAYLOAD;  break;
-    case S_PAYLOAD:                                              msg->state = S_ERROR;    break;
-    case S_CHECKSUM:    msg->state = ( nChar!=1 ) ? S_ERROR : S_COMPLETE;                 break;
-//  case S_TRAILER:
-//  case S_COMPLETE:
-//  case S_ERROR:
-    }
-    nChar = 0;
+    msg->payload[ msg->nPayload++ ] = ( hi<<4 ) | lo;
+    p += 2;
   }
-  
-  if( !ok )
-    msg->state = S_ERROR;
 
-  if( msg->state==S_PAYLOAD ) {
-    if( ( msg->rxFields & F_MAND ) != F_MAND ) {
-      msg->state = S_ERROR;
-    }
-  }
+  ps->p = ps->q = p;
+  return msg->nPayload == msg->len;
+}
 
-  if( msg->state==S_COMPLETE ) {
-    msg->rxFields |= msg->fields;
-    return 1;
-  }
+uint8_t msg_parse( struct message *msg, char const *line, uint16_t len, uint16_t *errPos ) {
+  struct msg_parser ps = { .line=line, .p=line, .q=line, .end=line };
+  uint8_t ok;
 
-  return 0;
+  while( ps.end < line+len && *ps.end!='\r' && *ps.end!='\n' && *ps.end!='\0' )
+    ps.end++;
+
+  ok = parse_field( &ps ) && parse_type( msg, &ps );
+  if( ok ) ok = parse_field( &ps ) && parse_param( msg, &ps, 0 );
+  if( ok ) ok = parse_field( &ps ) && parse_addr( msg, &ps, 0 );
+  if( ok ) ok = parse_field( &ps ) && parse_addr( msg, &ps, 1 );
+  if( ok ) ok = parse_field( &ps ) && parse_addr( msg, &ps, 2 );
+  if( ok ) ok = parse_field( &ps ) && parse_opcode( msg, &ps );
+  if( ok ) ok = parse_field( &ps ) && parse_len( msg, &ps );
+  if( ok ) ok = parse_field( &ps ) && parse_payload( msg, &ps );
+  if( ok ) ok = !parse_field( &ps );   // Nothing after the payload
+
+  msg->rxFields |= msg->fields;
+  if( !ok )
+    msg->error = MSG_BAD_TX;
+
+  if( errPos )
+    (*errPos) = ok ? 0 : (uint16_t)( ps.p - line );
+
+  return msg->error;
 }
 
 /********************************************************
@@ -915,11 +1263,13 @@ static uint8_t msg_tx_process( struct message *msg, uint8_t *done ) {
 }
 
 static struct message *TxMsg;
+static uint8_t txRaw[MAX_RAW];   // Radio working buffer
 static void msg_tx_start( struct message **msg ) {
   if( msg && (*msg) ) {
     TxMsg = (*msg);
+    msg_set_stage( TxMsg, MSG_ST_SEND );
 	TxMsg->csum = msg_checksum( TxMsg );
-    frame_tx_start( TxMsg->raw, MAX_RAW );
+    frame_tx_start( txRaw, MAX_RAW );
     (*msg) = NULL;
   }
 }
@@ -937,13 +1287,15 @@ uint8_t msg_tx_byte(uint8_t *done) {
 }
 
 void msg_tx_end( uint8_t nBytes ) {
-  if( TxMsg ) {
-    TxMsg->nBytes = nBytes;
+  if( TxMsg && TRACE(TRC_RAW) ) {
+    msg_raw_attach( TxMsg, txRaw, nBytes );
   }
 }
 
-void msg_tx_done(void) {
+void msg_tx_done( int64_t time ) {
   if( TxMsg ) {
+    TxMsg->time = time;
+
     // Make sure there's an RSSI value to print
     TxMsg->rxFields |= F_RSSI;
     TxMsg->rssi = 0;
@@ -980,4 +1332,5 @@ void msg_init( void ) {
   esp_log_level_set(TAG, CONFIG_MSG_LOG_LEVEL );
 
   msg_create_pool();
+  tx_lock = xSemaphoreCreateMutex();
 }
@@ -14,31 +14,88 @@
 #include <time.h>
 #include <sys/time.h>
 
+#include <esp_timer.h>
+
 #include "message.h"
 #include "msg.h"
 
-char *msg_timestamp( char *timestamp, int len ) {
+/*
+ * Convert an esp_timer time to an ISO 8601 wall clock string
+ *   YYYY-MM-DDTHH:MM:SS.uuuuuu+HH:MM
+ *
+ * This is only called when a message is printed or published,
+ * never on the radio core.
+ * The date/time and timezone are cached and only rebuilt with
+ * localtime()/strftime() when the second changes.
+ * The cache is not locked, only the gateway task formats timestamps.
+ */
+#define TS_PREFIX_LEN 19   // YYYY-MM-DDTHH:MM:SS
+#define TS_USEC_LEN    7   // .uuuuuu
+#define TS_TZ_LEN      6   // +HH:MM
+
+static struct ts_cache {
+  time_t sec;
+  char prefix[TS_PREFIX_LEN+1];
+  char tz[TS_TZ_LEN+1];
+} tsCache;
+
+static void msg_ts_cache_update( time_t sec ) {
+  struct tm nowtm;
+  char tz[8];
+
+  localtime_r( &sec, &nowtm );
+  strftime( tsCache.prefix, sizeof(tsCache.prefix), "%Y-%m-%dT%H:%M:%S", &nowtm );
+
+  // strftime does not generate ISO 8601 timezone - there's no ':'
+  strftime( tz,sizeof(tz), "%z", &nowtm );
+  tsCache.tz[0] = tz[0];
+  tsCache.tz[1] = tz[1];
+  tsCache.tz[2] = tz[2];
+  tsCache.tz[3] = ':';
+  tsCache.tz[4] = tz[3];
+  tsCache.tz[5] = tz[4];
+  tsCache.tz[6] = '\0';
+
+  tsCache.sec = sec;
+}
+
+char *msg_timestamp( char *timestamp, int len, int64_t time ) {
   struct timeval tv;
-  struct tm *nowtm;
-  ssize_t written = -1;
+  int64_t us;
+  uint32_t usec;
+  char *ts = timestamp;
+  int i;
+
+  if( len < TS_PREFIX_LEN + TS_USEC_LEN + TS_TZ_LEN + 1 ) {
+    if( len > 0 ) timestamp[0] = '\0';
+    return timestamp;
+  }
 
   gettimeofday(&tv, NULL);
-  nowtm = localtime(&tv.tv_sec);
-
-  written = (ssize_t)strftime( timestamp,len, "%Y-%m-%dT%H:%M:%S", nowtm);
-  if (( written>0 ) && ( (size_t)(written+7)<len ))
-    written += snprintf( timestamp+written, len-(size_t)written, ".%06ld", tv.tv_usec);
-  if (( written>0 ) && ( (size_t)(written+6)<len )) {
-	char tz[8];
-	strftime( tz,8, "%z", nowtm );
-	// strftime does not generate ISO 8601 timezone - there's no ':'
-	written += sprintf( timestamp+written,"%c%c%c:%c%c", tz[0],tz[1],tz[2],tz[3],tz[4] );
+  us  = tv.tv_sec * 1000000LL + tv.tv_usec;
+  us -= esp_timer_get_time() - time;
+
+  if( tsCache.sec != (time_t)( us / 1000000LL ) || !tsCache.prefix[0] )
+    msg_ts_cache_update( (time_t)( us / 1000000LL ) );
+  usec = (uint32_t)( us % 1000000LL );
+
+  memcpy( ts, tsCache.prefix, TS_PREFIX_LEN );
+  ts += TS_PREFIX_LEN;
+
+  *(ts++) = '.';
+  for( i=TS_USEC_LEN-1 ; i>0 ; i-- ) {
+    ts[i-1] = '0' + ( usec % 10 );
+    usec /= 10;
   }
+  ts += TS_USEC_LEN-1;
+
+  memcpy( ts, tsCache.tz, TS_TZ_LEN+1 );
 
   return timestamp;
 }
 
-char const *msg_get_ts( struct message const  *msg ){ return msg->timestamp; }
+char *msg_get_ts( struct message const *msg, char *ts, int len ){ return msg_timestamp( ts, len, msg->time ); }
+int64_t msg_get_time( struct message const *msg ){ return msg->time; }
 
 /********************************************************
 ** Message Header
@@ -111,7 +168,7 @@ void msg_decode_address( uint8_t *addr, uint8_t *class, uint32_t *id ) {
   }
 }
 
-void msg_make_addr( uint32_t *addr, uint8_t class, uint32_t id ) {
+void msg_make_address( uint32_t *addr, uint8_t class, uint32_t id ) {
   if( addr!=NULL ) {
 	uint8_t a[3];
     msg_encode_address( a, class, id );
@@ -256,7 +313,7 @@ uint8_t msg_isTx( struct message *msg ) {
 ** Create a message
 **/
 struct message *msg_create( enum msg_type type, uint32_t addr[MAX_ADDR], uint16_t opcode, uint8_t len, uint8_t *payload ) {
-  struct message *msg = msg_alloc();
+  struct message *msg = msg_alloc( MSG_POOL_GWAY );
   if( msg ) {
 	uint8_t fields  = type ;
 	uint8_t i;
@@ -266,9 +323,110 @@ struct message *msg_create( enum msg_type type, uint32_t addr[MAX_ADDR], uint16_
         fields |= F_ADDR0<<i ;
 	  }
 	}
+	msg_set_fields( msg, fields );
 	msg_set_opcode( msg, opcode );
     msg_set_payload( msg, len, payload );
+    msg->len = msg->nPayload;
+    msg->rxFields = fields | F_OPCODE | F_LEN;
   }
 
   return msg;
 }
+
+/************************************************************************************
+**
+** Structured TX
+**
+** Fill a message from its fields, or from the bytes of a frame,
+** without going through the HGI80 text format.
+**/
+uint8_t msg_tx_fields( struct message *msg, struct msg_tx const *tx ) {
+  uint8_t fields;
+  uint8_t i;
+
+  if( !msg || !tx || tx->type>MSG_TX_RP || tx->len==0 || tx->len>MAX_PAYLOAD || !tx->payload )
+    return MSG_BAD_TX;
+
+  fields = tx->type;
+  for( i=0 ; i<MAX_ADDR ; i++ ) {
+    struct msg_addr const *a = tx->addr + i;
+    if( a->class != MSG_ADDR_NONE ) {
+      if( a->class>0x3F || a->id>0x3FFFF )
+        return MSG_BAD_TX;
+      msg_encode_address( msg->addr[i], a->class, a->id );
+      fields |= F_ADDR0<<i;
+    }
+  }
+
+  if( tx->param >= 0 ) {
+    if( tx->param>0xFF )
+      return MSG_BAD_TX;
+    msg->param[0] = tx->param;
+    fields |= F_PARAM0;
+  }
+
+  // Not every combination of addresses can be sent
+  if( msg_encode_header( fields )==0xFF )
+    return MSG_BAD_TX;
+
+  msg_set_fields( msg, fields );
+  msg_set_opcode( msg, tx->opcode );
+  msg_set_payload( msg, tx->len, (uint8_t *)tx->payload );
+  msg->len = tx->len;
+  msg->rxFields = fields | F_OPCODE | F_LEN;
+
+  return MSG_OK;
+}
+
+/*
+ * Frame bytes as they are sent over the air, before Manchester encoding
+ *   HEADER [ADDR0] [ADDR1] [ADDR2] [PARAM0] [PARAM1] OPCODE(2) LEN PAYLOAD [CHECKSUM]
+ * Addresses are the encoded 3 byte form.
+ * If the checksum is present it must be correct.
+ */
+uint8_t msg_tx_frame( struct message *msg, uint8_t const *frame, uint8_t nBytes ) {
+  uint8_t const *b = frame, *end = frame+nBytes;
+  uint8_t fields;
+  uint8_t i;
+
+  if( !msg || !frame || nBytes<4 )
+    return MSG_BAD_TX;
+
+  fields = msg_decode_header( *(b++) );
+
+  for( i=0 ; i<MAX_ADDR ; i++ ) {
+    if( fields & ( F_ADDR0<<i ) ) {
+      if( end-b < 3 ) return MSG_BAD_TX;
+      memcpy( msg->addr[i], b, 3 );
+      b += 3;
+    }
+  }
+
+  for( i=0 ; i<2 ; i++ ) {
+    if( fields & ( F_PARAM0<<i ) ) {
+      if( end-b < 1 ) return MSG_BAD_TX;
+      msg->param[i] = *(b++);
+    }
+  }
+
+  if( end-b < 3 ) return MSG_BAD_TX;
+  msg->opcode[0] = *(b++);
+  msg->opcode[1] = *(b++);
+  msg->len = *(b++);
+
+  if( msg->len==0 || msg->len>MAX_PAYLOAD )
+    return MSG_BAD_TX;
+  if( end-b != msg->len && end-b != msg->len+1 )
+    return MSG_BAD_TX;
+
+  msg_set_payload( msg, msg->len, (uint8_t *)b );
+  b += msg->len;
+
+  msg_set_fields( msg, fields );
+  msg->rxFields = fields | F_OPCODE | F_LEN;
+
+  if( b<end && *b != msg_checksum( msg ) )
+    return MSG_CSUM_ERR;
+
+  return MSG_OK;
+}
@@ -16,8 +16,11 @@
 #define MAX_PAYLOAD 64
 #define MAX_ADDR 3
 struct message {
-  struct message *next;
-  struct message *prev;
+  int64_t time;      // esp_timer uS when the sync word was seen
+
+  uint8_t stage;     // Where the message is, see msg_cmd.h
+  uint8_t pool;      // Pool partition the message was allocated from
+  uint8_t raw;       // Attached raw frame buffer + 1, 0 for none
 
   uint8_t state;
   uint8_t count;
@@ -37,12 +40,6 @@ struct message {
 
   uint8_t nPayload;
   uint8_t payload[MAX_PAYLOAD];
-
-  uint8_t nBytes;
-  uint8_t raw[MAX_RAW];
-
-#define MSG_TIMESTAMP 36
-  char timestamp[MSG_TIMESTAMP];
 };
 
 /********************************************************
@@ -99,13 +96,17 @@ enum msg_type { _MSG_TYPE_LIST MSG_TYPE_MAX };
 #define HDR_PARAM1 0x01
 
 
-extern char *msg_timestamp( char *timestamp, int len );
+extern char *msg_timestamp( char *timestamp, int len, int64_t time );
 
 extern uint8_t msg_decode_header( uint8_t header );
 extern uint8_t msg_encode_header( uint8_t flags );
 
 extern void msg_reset( struct message *msg );
 
+extern uint8_t msg_raw_attach( struct message *msg, uint8_t const *raw, uint8_t nBytes );
+extern void msg_raw_detach( struct message *msg );
+extern uint8_t msg_raw_get( struct message const *msg, uint8_t const **raw );
+
 extern void msg_set_fields( struct message *msg, uint8_t  fields );
 extern void msg_get_fields( struct message *msg, uint8_t *fields );
 
@@ -0,0 +1,212 @@
+/********************************************************************
+ * ramses_esp
+ * msg_bin.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Binary serial protocol
+ * Record framing and RX message packing
+ *
+ * Only the C library is used here, tools/ramses_bin_decode.c and
+ * tools/ramses_bin_test.c link this same file.
+ *
+ */
+#include <string.h>
+
+#include "msg_bin.h"
+
+/********************************************************
+** CRC-16/CCITT-FALSE
+********************************************************/
+uint16_t msg_bin_crc( uint8_t const *data, size_t n ) {
+  uint16_t crc = 0xFFFF;
+
+  while( n-- ) {
+    uint8_t i;
+    crc ^= (uint16_t)( *(data++) ) << 8;
+    for( i=0 ; i<8 ; i++ )
+      crc = ( crc & 0x8000 ) ? ( crc<<1 ) ^ 0x1021 : ( crc<<1 );
+  }
+
+  return crc;
+}
+
+/********************************************************
+** COBS
+**
+** dst must have room for MSG_BIN_COBS_MAX(n) bytes.
+** The encoded data is followed by the 0x00 terminator.
+********************************************************/
+size_t msg_bin_cobs_encode( uint8_t const *src, size_t n, uint8_t *dst ) {
+  uint8_t *code = dst;
+  uint8_t *d = dst+1;
+  uint8_t run = 1;
+
+  while( n-- ) {
+    uint8_t byte = *(src++);
+    if( byte ) {
+      *(d++) = byte;
+      run++;
+    }
+
+    if( !byte || run==0xFF ) {
+      *code = run;
+      code = d++;
+      run = 1;
+    }
+  }
+
+  *code = run;
+  *(d++) = 0x00;
+
+  return d - dst;
+}
+
+// <src> excludes the terminator, returns the decoded length or 0 on error
+size_t msg_bin_cobs_decode( uint8_t const *src, size_t n, uint8_t *dst, size_t size ) {
+  uint8_t const *end = src+n;
+  uint8_t *d = dst;
+
+  while( src < end ) {
+    uint8_t code = *(src++);
+    uint8_t i;
+
+    if( !code || (size_t)( end-src ) < (size_t)( code-1 ) || (size_t)( d-dst ) + code-1 > size )
+      return 0;
+
+    for( i=1 ; i<code ; i++ )
+      *(d++) = *(src++);
+
+    if( code!=0xFF && src<end ) {
+      if( (size_t)( d-dst ) >= size )
+        return 0;
+      *(d++) = 0x00;
+    }
+  }
+
+  return d - dst;
+}
+
+/********************************************************
+** Records
+********************************************************/
+static inline uint8_t *put_u32( uint8_t *p, uint32_t v ) {
+  p[0] = v;  p[1] = v>>8;  p[2] = v>>16;  p[3] = v>>24;
+  return p+4;
+}
+
+static inline uint32_t get_u32( uint8_t const *p ) {
+  return (uint32_t)p[0] | (uint32_t)p[1]<<8 | (uint32_t)p[2]<<16 | (uint32_t)p[3]<<24;
+}
+
+size_t msg_bin_record( uint8_t type, uint32_t seq, uint8_t const *body, size_t nBody, uint8_t *dst, size_t size ) {
+  uint8_t rec[MSG_BIN_RX_MAX];
+  uint8_t *p = rec;
+  uint16_t crc;
+  size_t n;
+
+  if( nBody > sizeof(rec) - MSG_BIN_HDR - MSG_BIN_CRC )
+    return 0;
+
+  *(p++) = type;
+  p = put_u32( p, seq );
+  if( nBody )
+    memcpy( p, body, nBody );
+  p += nBody;
+
+  crc = msg_bin_crc( rec, p-rec );
+  *(p++) = crc;
+  *(p++) = crc>>8;
+
+  n = p - rec;
+  if( size < 1 + MSG_BIN_COBS_MAX(n) )
+    return 0;
+
+  dst[0] = 0x00;
+  return 1 + msg_bin_cobs_encode( rec, n, dst+1 );
+}
+
+int msg_bin_check( uint8_t const *rec, size_t n, uint8_t *type, uint32_t *seq ) {
+  uint16_t crc;
+
+  if( n < MSG_BIN_HDR + MSG_BIN_CRC )
+    return -1;
+
+  crc = (uint16_t)rec[n-2] | (uint16_t)rec[n-1]<<8;
+  if( crc != msg_bin_crc( rec, n-2 ) )
+    return -1;
+
+  if( type ) (*type) = rec[0];
+  if( seq  ) (*seq)  = get_u32( rec+1 );
+
+  return (int)( n - MSG_BIN_HDR - MSG_BIN_CRC );
+}
+
+/********************************************************
+** RX message body
+********************************************************/
+size_t msg_bin_pack_rx( struct msg_bin_rx const *rx, uint8_t *body, size_t size ) {
+  uint8_t *p = body;
+  uint8_t i;
+
+  if( rx->nPayload > MSG_BIN_PAYLOAD || rx->nRaw > MSG_BIN_RAW )
+    return 0;
+  if( size < (size_t)( 8+4+9+2+2+1 + 1+rx->nPayload + 1+rx->nRaw ) )
+    return 0;
+
+  for( i=0 ; i<8 ; i++ )
+    *(p++) = (uint8_t)( (uint64_t)rx->time >> ( 8*i ) );
+
+  *(p++) = rx->rssi;
+  *(p++) = rx->rxFields;
+  *(p++) = rx->fields;
+  *(p++) = rx->error;
+
+  memcpy( p, rx->addr, 9 );    p += 9;
+  memcpy( p, rx->param, 2 );   p += 2;
+  memcpy( p, rx->opcode, 2 );  p += 2;
+  *(p++) = rx->len;
+
+  *(p++) = rx->nPayload;
+  memcpy( p, rx->payload, rx->nPayload );  p += rx->nPayload;
+
+  *(p++) = rx->nRaw;
+  memcpy( p, rx->raw, rx->nRaw );  p += rx->nRaw;
+
+  return p - body;
+}
+
+int msg_bin_unpack_rx( uint8_t const *body, size_t n, struct msg_bin_rx *rx ) {
+  uint8_t const *p = body, *end = body+n;
+  uint64_t time = 0;
+  uint8_t i;
+
+  if( n < 8+4+9+2+2+1+1+1 )
+    return -1;
+
+  for( i=0 ; i<8 ; i++ )
+    time |= (uint64_t)( *(p++) ) << ( 8*i );
+  rx->time = (int64_t)time;
+
+  rx->rssi     = *(p++);
+  rx->rxFields = *(p++);
+  rx->fields   = *(p++);
+  rx->error    = *(p++);
+
+  memcpy( rx->addr, p, 9 );    p += 9;
+  memcpy( rx->param, p, 2 );   p += 2;
+  memcpy( rx->opcode, p, 2 );  p += 2;
+  rx->len = *(p++);
+
+  rx->nPayload = *(p++);
+  if( rx->nPayload > MSG_BIN_PAYLOAD || end-p < rx->nPayload+1 )
+    return -1;
+  memcpy( rx->payload, p, rx->nPayload );  p += rx->nPayload;
+
+  rx->nRaw = *(p++);
+  if( rx->nRaw > MSG_BIN_RAW || end-p != rx->nRaw )
+    return -1;
+  memcpy( rx->raw, p, rx->nRaw );
+
+  return 0;
+}
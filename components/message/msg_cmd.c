@@ -0,0 +1,166 @@
+/********************************************************************
+ * ramses_esp
+ * msg_cmd.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Message Commands
+ *
+ */
+#include "cmd.h"
+#include "msg_cmd.h"
+#include "message.h"
+
+/*********************************************************
+ * Message queues
+ */
+static char const *msg_queue_text( enum msg_queue q ) {
+  static char const * const queue_text[MSG_QUEUE_MAX] = {
+    #define MSG_QUEUE( _e,_t ) _t,
+    MSG_QUEUE_LIST
+    #undef MSG_QUEUE
+  };
+
+  char const *text = "Unknown";
+  if( q<MSG_QUEUE_MAX )
+    text = queue_text[q];
+
+  return text;
+}
+
+static int msg_cmd_queues( int argc, char **argv ) {
+  enum msg_queue q;
+
+  if( argc>1 && !strcmp( argv[1], "reset" ) ) {
+    msg_queue_stats_reset();
+    return 0;
+  }
+
+  printf("# %-6s %8s %8s %8s %10s %8s %8s\n", "queue", "size", "level", "hwm", "count", "fail", "drop" );
+  for( q=0 ; q<MSG_QUEUE_MAX ; q++ ) {
+    struct msg_queue_stats stats;
+    msg_queue_stats( q, &stats );
+    printf("# %-6s %8lu %8lu %8lu %10lu %8lu %8lu\n", msg_queue_text(q),
+           stats.capacity, stats.level, stats.hwm, stats.count, stats.fail, stats.drop );
+  }
+
+  return 0;
+}
+
+/*********************************************************
+ * Pool partitions
+ */
+static char const *msg_class_text( enum msg_pool_class cls ) {
+  static char const * const class_text[MSG_POOL_MAX] = {
+    [MSG_POOL_RX]   = "rx",
+    [MSG_POOL_TX]   = "tx",
+    [MSG_POOL_GWAY] = "gway",
+  };
+
+  char const *text = "Unknown";
+  if( cls<MSG_POOL_MAX )
+    text = class_text[cls];
+
+  return text;
+}
+
+static int msg_cmd_pool( int argc, char **argv ) {
+  enum msg_pool_class cls;
+
+  if( argc>1 && !strcmp( argv[1], "reset" ) ) {
+    msg_class_stats_reset();
+    return 0;
+  }
+
+  printf("# %-6s %8s %8s %8s %8s %10s %8s %8s\n", "class", "reserve", "limit", "level", "hwm", "count", "fail", "drop" );
+  for( cls=0 ; cls<MSG_POOL_MAX ; cls++ ) {
+    struct msg_class_stats stats;
+    msg_class_stats( cls, &stats );
+    printf("# %-6s %8lu %8lu %8lu %8lu %10lu %8lu %8lu\n", msg_class_text(cls),
+           stats.reserve, stats.limit, stats.level, stats.hwm, stats.count, stats.fail, stats.drop );
+  }
+
+  return 0;
+}
+
+/*********************************************************
+ * Message stages
+ */
+static char const *msg_stage_text( enum msg_stage stage ) {
+  static char const * const stage_text[MSG_STAGE_MAX] = {
+    [MSG_ST_NONE] = "free",
+    #define MSG_STAGE( _e,_t ) [_e] = _t,
+    MSG_STAGE_LIST
+    #undef MSG_STAGE
+  };
+
+  char const *text = "Unknown";
+  if( stage<MSG_STAGE_MAX )
+    text = stage_text[stage];
+
+  return text;
+}
+
+static int msg_cmd_stages( int argc, char **argv ) {
+  enum msg_stage stage;
+
+  if( argc>1 && !strcmp( argv[1], "reset" ) ) {
+    msg_stage_stats_reset();
+    return 0;
+  }
+
+  printf("# %-6s %8s %8s %10s\n", "stage", "level", "hwm", "count" );
+  for( stage=MSG_ST_NONE+1 ; stage<MSG_STAGE_MAX ; stage++ ) {
+    struct msg_queue_stats stats;
+    msg_stage_stats( stage, &stats );
+    printf("# %-6s %8lu %8lu %10lu\n", msg_stage_text(stage),
+           stats.level, stats.hwm, stats.count );
+  }
+
+  return 0;
+}
+
+/*********************************************************
+ * Top Level command
+ */
+
+static esp_console_cmd_t const msg_cmds[] = {
+  {
+    .command = "queues",
+    .help = "Show message pool and queue levels, 'queues reset' to clear",
+    .hint = NULL,
+    .func = &msg_cmd_queues,
+  },
+  {
+    .command = "pool",
+    .help = "Show message pool partitions, 'pool reset' to clear",
+    .hint = NULL,
+    .func = &msg_cmd_pool,
+  },
+  {
+    .command = "stages",
+    .help = "Show messages in each processing stage, 'stages reset' to clear",
+    .hint = NULL,
+    .func = &msg_cmd_stages,
+  },
+  // List termination
+  { NULL_COMMAND }
+};
+
+static int msg_cmd( int argc, char **argv ) {
+  return cmd_menu( argc, argv, msg_cmds, argv[0] );
+}
+
+void msg_register(void) {
+  const esp_console_cmd_t msg[] = {
+    {
+      .command = "msg",
+      .help = "Message commands, enter 'msg' for list",
+	  .hint = NULL,
+	  .func = &msg_cmd,
+    },
+	{ NULL_COMMAND }
+  };
+
+  cmd_menu_register( msg );
+}
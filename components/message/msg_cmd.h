@@ -0,0 +1,73 @@
+/********************************************************************
+ * ramses_esp
+ * msg_cmd.h
+ *
+ * (C) 2025 Peter Price
+ *
+ * Message Commands
+ *
+ */
+#ifndef _MSG_CMD_H_
+#define _MSG_CMD_H_
+
+#include <stdint.h>
+
+#include "message.h"
+
+#define MSG_QUEUE_LIST \
+  MSG_QUEUE( MSG_Q_POOL, "pool" ) \
+  MSG_QUEUE( MSG_Q_RAW,  "raw" ) \
+  MSG_QUEUE( MSG_Q_TX,   "tx" ) \
+  MSG_QUEUE( MSG_Q_RX,   "rx" ) \
+
+#define MSG_QUEUE( _e, _t ) _e,
+enum msg_queue {
+  MSG_QUEUE_LIST
+  MSG_QUEUE_MAX
+};
+#undef MSG_QUEUE
+
+struct msg_queue_stats {
+  uint32_t capacity;
+  uint32_t level;   // Pool: messages in use
+  uint32_t hwm;     // Highest level
+  uint32_t count;   // Messages queued or allocated
+  uint32_t fail;    // Queue full, pool empty or RX consumer not woken
+  uint32_t drop;    // Discarded by RX overflow policy
+};
+
+extern void msg_queue_stats( enum msg_queue q, struct msg_queue_stats *stats );
+extern void msg_queue_stats_reset( void );
+
+struct msg_class_stats {
+  uint32_t reserve; // Only available to this class
+  uint32_t limit;   // Most the class can use
+  uint32_t level;
+  uint32_t hwm;
+  uint32_t count;   // Allocations
+  uint32_t fail;    // Allocations refused
+  uint32_t drop;    // Discarded on the way to the host
+};
+
+extern void msg_class_stats( enum msg_pool_class cls, struct msg_class_stats *stats );
+extern void msg_class_stats_reset( void );
+
+#define MSG_STAGE_LIST \
+  MSG_STAGE( MSG_ST_RX,   "rx" )   /* Being decoded by the radio */ \
+  MSG_STAGE( MSG_ST_GWAY, "gway" ) /* Waiting in the RX list */ \
+  MSG_STAGE( MSG_ST_HOST, "host" ) /* Being formatted or built by a host task */ \
+  MSG_STAGE( MSG_ST_TX,   "tx" )   /* Waiting in the TX list */ \
+  MSG_STAGE( MSG_ST_SEND, "send" ) /* Being transmitted */ \
+
+#define MSG_STAGE( _e, _t ) _e,
+enum msg_stage {
+  MSG_ST_NONE,     // Free
+  MSG_STAGE_LIST
+  MSG_STAGE_MAX
+};
+#undef MSG_STAGE
+
+extern void msg_stage_stats( enum msg_stage stage, struct msg_queue_stats *stats );
+extern void msg_stage_stats_reset( void );
+
+#endif // _MSG_CMD_H_
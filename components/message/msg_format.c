@@ -0,0 +1,125 @@
+/********************************************************************
+ * ramses_esp
+ * msg_format.c
+ *
+ * (C) 2023 Peter Price
+ *
+ * RAMSES message handling
+ * HGI80 text formatting of messages for the host
+ *
+ * This needs nothing from the rest of the firmware so
+ * tools/msg_format_test.c can build it on a host.
+ *
+ */
+#include <string.h>
+
+#include "message.h"
+#include "msg.h"
+
+
+/************************************************************************************
+**
+** msg_format
+**
+** Format the whole HGI80 line in one pass.
+** Produces exactly the same text as the old sprintf based msg_print_all(),
+** tools/msg_format_test.c keeps that as the reference.
+** Every field has a fixed width so the space needed is known up front.
+** Errors and raw bytes are not printed.
+**
+** Returns the length of the line, or 0 if it doesn't fit in <size>
+**/
+#define HEX_ROW(_h) _h"0" _h"1" _h"2" _h"3" _h"4" _h"5" _h"6" _h"7" \
+                    _h"8" _h"9" _h"A" _h"B" _h"C" _h"D" _h"E" _h"F"
+static char const hex_table[256*2+1] =
+  HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+  HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+  HEX_ROW("8") HEX_ROW("9") HEX_ROW("A") HEX_ROW("B")
+  HEX_ROW("C") HEX_ROW("D") HEX_ROW("E") HEX_ROW("F");
+#undef HEX_ROW
+
+// "%2s " of MsgType
+static char const fmt_type[MSG_TYPE_MAX][2] = { {'R','Q'}, {' ','I'}, {' ','W'}, {'R','P'} };
+
+#define FMT_FIXED ( 4 + 3 + 4 + 3*10 + 5 + 4 )   // Everything except the payload
+_Static_assert( FMT_FIXED + 2*MAX_PAYLOAD + 1 <= MSG_LINE_MAX, "MSG_LINE_MAX too small" );
+
+static inline char *fmt_hex( char *p, uint8_t byte ) {
+  p[0] = hex_table[ 2*byte   ];
+  p[1] = hex_table[ 2*byte+1 ];
+  return p+2;
+}
+
+static inline char *fmt_dec3( char *p, uint8_t value ) {
+  p[0] = '0' + value / 100;
+  p[1] = '0' + ( value / 10 ) % 10;
+  p[2] = '0' + value % 10;
+  p[3] = ' ';
+  return p+4;
+}
+
+static inline char *fmt_text( char *p, char const *text, uint8_t len ) {
+  memcpy( p, text, len );
+  return p+len;
+}
+
+static char *fmt_addr( char *p, uint8_t const *addr, uint8_t valid ) {
+  if( valid ) {
+    uint8_t class = ( addr[0] & 0xFC ) >> 2;
+    uint32_t id = (uint32_t)( addr[0] & 0x03 ) << 16
+                | (uint32_t)( addr[1]        ) <<  8
+                | (uint32_t)( addr[2]        )       ;
+    int8_t i;
+
+    p[0] = '0' + class / 10;
+    p[1] = '0' + class % 10;
+    p[2] = ':';
+    for( i=8 ; i>2 ; i-- ) {   // id < 2^18 so never more than 6 digits
+      p[i] = '0' + id % 10;
+      id /= 10;
+    }
+    p[9] = ' ';
+    return p+10;
+  }
+
+  return fmt_text( p, "--:------ ", 10 );
+}
+
+uint16_t msg_format( struct message const *msg, char *buf, uint16_t size ) {
+  char *p = buf;
+  uint8_t rxFields = msg->rxFields;
+  uint8_t i;
+
+  if( size < FMT_FIXED + 2*msg->nPayload + 1 ) {
+    if( size ) buf[0] = '\0';
+    return 0;
+  }
+
+  p = ( rxFields & F_RSSI ) ? fmt_dec3( p, msg->rssi ) : fmt_text( p, "--- ", 4 );
+
+  p = fmt_text( p, fmt_type[ msg->fields & F_MASK ], 2 );
+  *(p++) = ' ';
+
+  p = ( rxFields & F_PARAM0 ) ? fmt_dec3( p, msg->param[0] ) : fmt_text( p, "--- ", 4 );
+
+  p = fmt_addr( p, msg->addr[0], rxFields & F_ADDR0 );
+  p = fmt_addr( p, msg->addr[1], rxFields & F_ADDR1 );
+  p = fmt_addr( p, msg->addr[2], rxFields & F_ADDR2 );
+
+  if( rxFields & F_OPCODE ) {
+    p = fmt_hex( p, msg->opcode[0] );
+    p = fmt_hex( p, msg->opcode[1] );
+    *(p++) = ' ';
+  } else {
+    p = fmt_text( p, "???? ", 5 );
+  }
+
+  p = ( rxFields & F_LEN ) ? fmt_dec3( p, msg->len ) : fmt_text( p, "??? ", 4 );
+
+  for( i=0 ; i<msg->nPayload ; i++ )
+    p = fmt_hex( p, msg->payload[i] );
+
+  *p = '\0';
+
+  return (uint16_t)( p - buf );
+}
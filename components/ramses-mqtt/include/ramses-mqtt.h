@@ -19,4 +19,8 @@ extern char const *NET_get_mqtt_password(void);
 extern MQTT_HNDL ramses_mqtt_init( BaseType_t coreID );
 extern void MQTT_publish_rx( char const *ts, char const *msg );
 
+// Publish a pending RX batch if it is due.
+// Returns the ticks until the next one is due or portMAX_DELAY.
+extern TickType_t MQTT_publish_rx_poll( void );
+
 #endif // _RAMSES_MQTT_H_
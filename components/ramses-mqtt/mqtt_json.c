@@ -0,0 +1,291 @@
+/********************************************************************
+ * ramses_esp
+ * mqtt_json.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Fixed buffer JSON for the MQTT rx and tx topics
+ *
+ * Replaces cJSON on the per-message paths, which allocated for every
+ * frame published and every TX command received.
+ *
+ * Plain C with no ESP-IDF headers, tools/mqtt_json_bench.c builds it
+ * on a host to compare it with cJSON.
+ *
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "mqtt_json.h"
+
+/********************************************************
+** Writer
+********************************************************/
+struct json_out {
+  char *p;
+  char *end;    // Leaves room for the terminating NUL
+};
+
+static void put_text( struct json_out *out, char const *text, size_t n ) {
+  if( out->p <= out->end && (size_t)( out->end - out->p ) >= n ) {
+    memcpy( out->p, text, n );
+    out->p += n;
+  } else {
+    out->p = out->end + 1;   // Overflowed
+  }
+}
+
+static void put_string( struct json_out *out, char const *s ) {
+  static char const hex[] = "0123456789abcdef";
+
+  put_text( out, "\"", 1 );
+
+  while( *s && out->p <= out->end ) {
+    // Copy the run that needs no escaping in one go
+    char const *run = s;
+    while( *s && *s!='"' && *s!='\\' && (uint8_t)(*s) >= 0x20 )
+      s++;
+    put_text( out, run, s-run );
+
+    if( *s ) {
+      uint8_t c = *(s++);
+      char esc[6] = { '\\', c, '0', '0', hex[c>>4], hex[c&0xF] };
+      if( c=='"' || c=='\\' ) {
+        put_text( out, esc, 2 );
+      } else {
+        esc[1] = 'u';
+        put_text( out, esc, 6 );
+      }
+    }
+  }
+
+  put_text( out, "\"", 1 );
+}
+
+size_t mqtt_json_rx( char *buf, size_t size, char const *msg, char const *ts ) {
+  struct json_out out = { buf, buf+size-1 };
+
+  if( !size )
+    return 0;
+
+  put_text( &out, "{\"msg\":", 7 );
+  put_string( &out, msg );
+  put_text( &out, ",\"ts\":", 6 );
+  put_string( &out, ts );
+  put_text( &out, "}", 1 );
+
+  if( out.p > out.end ) {
+    buf[0] = '\0';
+    return 0;
+  }
+
+  *(out.p) = '\0';
+  return out.p - buf;
+}
+
+/********************************************************
+** Extractor
+********************************************************/
+struct json_in {
+  char const *p;
+  char const *end;
+};
+
+static void skip_ws( struct json_in *in ) {
+  while( in->p < in->end && ( *in->p==' ' || *in->p=='\t' || *in->p=='\r' || *in->p=='\n' ) )
+    in->p++;
+}
+
+static int hex4( struct json_in *in, uint16_t *value ) {
+  uint8_t i;
+
+  if( in->end - in->p < 4 )
+    return 0;
+
+  (*value) = 0;
+  for( i=0 ; i<4 ; i++ ) {
+    char c = *(in->p++);
+    uint8_t nibble;
+    if( c>='0' && c<='9' )      nibble = c - '0';
+    else if( c>='a' && c<='f' ) nibble = c - 'a' + 10;
+    else if( c>='A' && c<='F' ) nibble = c - 'A' + 10;
+    else return 0;
+    (*value) = ( (*value)<<4 ) | nibble;
+  }
+
+  return 1;
+}
+
+static void out_byte( char *out, size_t size, int n, char c ) {
+  if( out && (size_t)n+1 < size )
+    out[n] = c;
+}
+
+// Decode the string at <in>, <out> may be NULL to skip it.
+// Returns the full decoded length, only size-1 bytes are stored,
+// or -1 if the string is malformed
+static int get_string( struct json_in *in, char *out, size_t size ) {
+  int n = 0;
+
+  if( in->p >= in->end || *in->p!='"' )
+    return -1;
+  in->p++;
+
+  while( in->p < in->end ) {
+    uint8_t c = *(in->p++);
+
+    if( c=='"' ) {
+      if( out && size )
+        out[ ( (size_t)n < size ) ? (size_t)n : size-1 ] = '\0';
+      return n;
+    }
+
+    if( c < 0x20 )
+      return -1;
+
+    if( c=='\\' ) {
+      uint32_t cp;
+      uint16_t u;
+
+      if( in->p >= in->end )
+        return -1;
+
+      c = *(in->p++);
+      switch( c ) {
+      case '"': case '\\': case '/': break;
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+
+      case 'u':
+        if( !hex4( in, &u ) )
+          return -1;
+        cp = u;
+
+        if( u>=0xD800 && u<=0xDBFF ) {
+          uint16_t lo;
+          if( in->end - in->p < 2 || in->p[0]!='\\' || in->p[1]!='u' )
+            return -1;
+          in->p += 2;
+          if( !hex4( in, &lo ) || lo<0xDC00 || lo>0xDFFF )
+            return -1;
+          cp = 0x10000 + ( ( cp-0xD800 )<<10 ) + ( lo-0xDC00 );
+        } else if( u>=0xDC00 && u<=0xDFFF ) {
+          return -1;
+        }
+
+        // UTF-8
+        if( cp < 0x80 ) {
+          out_byte( out, size, n++, cp );
+        } else if( cp < 0x800 ) {
+          out_byte( out, size, n++, 0xC0 | ( cp>>6 ) );
+          out_byte( out, size, n++, 0x80 | ( cp & 0x3F ) );
+        } else if( cp < 0x10000 ) {
+          out_byte( out, size, n++, 0xE0 | ( cp>>12 ) );
+          out_byte( out, size, n++, 0x80 | ( ( cp>>6 ) & 0x3F ) );
+          out_byte( out, size, n++, 0x80 | ( cp & 0x3F ) );
+        } else {
+          out_byte( out, size, n++, 0xF0 | ( cp>>18 ) );
+          out_byte( out, size, n++, 0x80 | ( ( cp>>12 ) & 0x3F ) );
+          out_byte( out, size, n++, 0x80 | ( ( cp>>6 ) & 0x3F ) );
+          out_byte( out, size, n++, 0x80 | ( cp & 0x3F ) );
+        }
+        continue;
+
+      default:
+        return -1;
+      }
+    }
+
+    out_byte( out, size, n++, c );
+  }
+
+  return -1;   // Unterminated
+}
+
+// Skip any value, nested values only have their brackets counted
+static int skip_value( struct json_in *in ) {
+  char const *start = in->p;
+  int depth = 0;
+
+  if( in->p >= in->end )
+    return 0;
+
+  if( *in->p=='"' )
+    return get_string( in, NULL, 0 ) >= 0;
+
+  if( *in->p=='{' || *in->p=='[' ) {
+    do {
+      char c = *in->p;
+      if( c=='"' ) {
+        if( get_string( in, NULL, 0 ) < 0 )
+          return 0;
+        continue;
+      }
+
+      if( c=='{' || c=='[' )      depth++;
+      else if( c=='}' || c==']' ) depth--;
+      in->p++;
+    } while( depth && in->p < in->end );
+
+    return !depth;
+  }
+
+  // Number, true, false or null
+  while( in->p < in->end && ( ( *in->p>='0' && *in->p<='9' ) || ( *in->p>='a' && *in->p<='z' )
+                           || *in->p=='-' || *in->p=='+' || *in->p=='.' || *in->p=='E' ) )
+    in->p++;
+
+  return in->p != start;
+}
+
+int mqtt_json_string( char const *json, size_t len, char const *key, char *value, size_t size ) {
+  struct json_in in = { json, json+len };
+  size_t keyLen = strlen( key );
+
+  skip_ws( &in );
+  if( in.p >= in.end || *in.p!='{' )
+    return -1;
+  in.p++;
+
+  skip_ws( &in );
+  if( in.p < in.end && *in.p=='}' )
+    return -1;
+
+  while( in.p < in.end ) {
+    char name[16];
+    int nName;
+
+    skip_ws( &in );
+    nName = get_string( &in, name, sizeof(name) );
+    if( nName < 0 )
+      return -1;
+
+    skip_ws( &in );
+    if( in.p >= in.end || *in.p!=':' )
+      return -1;
+    in.p++;
+    skip_ws( &in );
+
+    if( (size_t)nName==keyLen && (size_t)nName<sizeof(name) && !memcmp( name, key, keyLen ) ) {
+      int n = get_string( &in, value, size );
+      return ( n>=0 && (size_t)n<size ) ? n : -1;
+    }
+
+    if( !skip_value( &in ) )
+      return -1;
+
+    skip_ws( &in );
+    if( in.p >= in.end )
+      return -1;
+    if( *in.p=='}' )
+      return -1;      // Not found
+    if( *in.p!=',' )
+      return -1;
+    in.p++;
+  }
+
+  return -1;
+}
@@ -0,0 +1,29 @@
+/********************************************************************
+ * ramses_esp
+ * mqtt_json.h
+ *
+ * (C) 2025 Peter Price
+ *
+ * Fixed buffer JSON for the MQTT rx and tx topics
+ *
+ * No heap is used. These only handle the flat objects on those
+ * topics, they are not a general JSON library.
+ *
+ */
+#ifndef _MQTT_JSON_H_
+#define _MQTT_JSON_H_
+
+#include <stddef.h>
+
+// {"msg":"<msg>","ts":"<ts>"}
+// Returns the length excluding the terminating NUL or 0 if it doesn't fit
+extern size_t mqtt_json_rx( char *buf, size_t size, char const *msg, char const *ts );
+
+// Find the string value of top level <key> in the object in <json>.
+// <json> does not need to be NUL terminated.
+// The decoded value is copied to <value> with a terminating NUL.
+// Returns the length of the value, or -1 if the object is malformed,
+// the key is absent or not a string, or the value doesn't fit
+extern int mqtt_json_string( char const *json, size_t len, char const *key, char *value, size_t size );
+
+#endif // _MQTT_JSON_H_
@@ -18,13 +18,14 @@ static const char *TAG = "MQTT";
 #include "esp_app_desc.h"
 
 #include "mqtt_client.h"
-#include "cJSON.h"
+#include "esp_console.h"
 
 #include "cmd.h"
 #include "device.h"
 #include "gateway.h"
 #include "ramses_wifi.h"
 #include "ramses-mqtt.h"
+#include "mqtt_json.h"
 
 /****************************************************
  * States
@@ -184,23 +185,189 @@ static void mqtt_publish_info( struct mqtt_data *ctxt ) {
 
 /*******************************************************************************
  * RX message
+ *
+ * Each frame is published on <topic>/rx by default.
+ * With MQTT_RX_BATCH frames are collected into a JSON array of the
+ * {"msg","ts"} objects published on <topic>/rx/batch.
+ * The batch is published when it is MQTT_RX_BATCH_MS old or
+ * the next frame would not fit in MQTT_RX_BATCH_SIZE.
  */
+#if CONFIG_MQTT_RX_BATCH
+
+#define MQTT_FLUSH_LIST \
+  MQTT_FLUSH( MQTT_FLUSH_TIME, "time" ) /* Latency bound */ \
+  MQTT_FLUSH( MQTT_FLUSH_SIZE, "size" ) /* Buffer full */ \
+  MQTT_FLUSH( MQTT_FLUSH_DOWN, "down" ) /* Discarded, not connected */ \
+
+#define MQTT_FLUSH( _e, _t ) _e,
+enum mqtt_flush {
+  MQTT_FLUSH_LIST
+  MQTT_FLUSH_MAX
+};
+#undef MQTT_FLUSH
+
+// Only the sink worker writes the counters. 'batch reset' takes a
+// copy in the console task and later reports are relative to it.
+struct mqtt_batch_stats {
+  uint32_t frames;
+  uint32_t dropped;   // Too long for a batch
+  uint32_t flush[MQTT_FLUSH_MAX];
+};
+
+static struct mqtt_batch_stats mqtt_batch_stats;
+static struct mqtt_batch_stats mqtt_batch_base;
+
+#define BATCH_TICKS pdMS_TO_TICKS( CONFIG_MQTT_RX_BATCH_MS )
+
+static struct mqtt_batch {
+  TickType_t start;
+  uint16_t count;
+  uint16_t n;
+  char buf[CONFIG_MQTT_RX_BATCH_SIZE];
+} mqtt_batch;
+
+static void mqtt_batch_flush( struct mqtt_data *ctxt, enum mqtt_flush reason ) {
+  struct mqtt_batch *batch = &mqtt_batch;
+
+  if( !batch->count )
+    return;
+
+  if( ctxt->state == MQTT_ACTIVE ) {
+    char topic[64];
+
+    // Room for the ']' was kept when the frames were added
+    batch->buf[ batch->n++ ] = ']';
+    sprintf( topic, "%s/rx/batch", ctxt->topic );
+    esp_mqtt_client_publish( ctxt->client,topic, batch->buf, batch->n, 1, 0 );
+  } else {
+    reason = MQTT_FLUSH_DOWN;
+  }
+
+  mqtt_batch_stats.flush[reason]++;
+  batch->count = 0;
+  batch->n = 0;
+}
+
+// Write the object after the '[' or ',' keeping room for the ']'
+static size_t mqtt_batch_obj( struct mqtt_batch *batch, char const *ts, char const *msg ) {
+  size_t space = sizeof(batch->buf) - batch->n;
+  return ( space > 2 ) ? mqtt_json_rx( batch->buf + batch->n + 1, space-2, msg, ts ) : 0;
+}
+
+static void mqtt_batch_add( struct mqtt_data *ctxt, char const *ts, char const *msg ) {
+  struct mqtt_batch *batch = &mqtt_batch;
+  size_t len;
+
+  len = mqtt_batch_obj( batch, ts, msg );
+  if( !len && batch->count ) {
+    mqtt_batch_flush( ctxt, MQTT_FLUSH_SIZE );
+    len = mqtt_batch_obj( batch, ts, msg );
+  }
+
+  if( !len ) {
+    mqtt_batch_stats.dropped++;
+    ESP_LOGW( TAG, "RX too long <%s>", msg );
+    return;
+  }
+
+  batch->buf[ batch->n ] = batch->count ? ',' : '[';
+  batch->n += 1 + len;
+  if( !batch->count++ )
+    batch->start = xTaskGetTickCount();
+  mqtt_batch_stats.frames++;
+
+  // Don't wait for the timeout if a similar frame won't fit
+  if( sizeof(batch->buf) - batch->n < len + 3 )
+    mqtt_batch_flush( ctxt, MQTT_FLUSH_SIZE );
+}
+
+TickType_t MQTT_publish_rx_poll( void ) {
+  struct mqtt_batch *batch = &mqtt_batch;
+  TickType_t age;
+
+  if( !batch->count )
+    return portMAX_DELAY;
+
+  age = xTaskGetTickCount() - batch->start;
+  if( age >= BATCH_TICKS ) {
+    mqtt_batch_flush( mqtt_ctxt(), MQTT_FLUSH_TIME );
+    return portMAX_DELAY;
+  }
+
+  return BATCH_TICKS - age;
+}
+
+void MQTT_publish_rx( char const *ts, char const *msg ) {
+  struct mqtt_data *ctxt= mqtt_ctxt();
+  if( ctxt->state == MQTT_ACTIVE )
+    mqtt_batch_add( ctxt, ts, msg );
+}
+
+static char const *mqtt_flush_text( enum mqtt_flush reason ) {
+  static char const * const flush_text[MQTT_FLUSH_MAX] = {
+    #define MQTT_FLUSH( _e,_t ) _t,
+    MQTT_FLUSH_LIST
+    #undef MQTT_FLUSH
+  };
+
+  char const *text = "Unknown";
+  if( reason<MQTT_FLUSH_MAX )
+    text = flush_text[reason];
+
+  return text;
+}
+
+static int mqtt_batch_cmd( int argc, char **argv ) {
+  struct mqtt_batch_stats const *now = &mqtt_batch_stats;
+  struct mqtt_batch_stats const *base = &mqtt_batch_base;
+  enum mqtt_flush reason;
+
+  if( argc>1 && !strcmp( argv[1], "reset" ) ) {
+    mqtt_batch_base = mqtt_batch_stats;
+    return 0;
+  }
+
+  printf("# %-6s %10s %10s\n", "batch", "frames", "dropped" );
+  printf("# %-6s %10lu %10lu\n", "rx", now->frames - base->frames, now->dropped - base->dropped );
+
+  printf("# %-6s %10s\n", "flush", "count" );
+  for( reason=0 ; reason<MQTT_FLUSH_MAX ; reason++ )
+    printf("# %-6s %10lu\n", mqtt_flush_text(reason), now->flush[reason] - base->flush[reason] );
+
+  return 0;
+}
+
+static void mqtt_register_batch( void ) {
+  const esp_console_cmd_t cmd = {
+    .command = "batch",
+    .help = "Show MQTT rx batch flushes, 'batch reset' to clear",
+    .hint = NULL,
+    .func = &mqtt_batch_cmd,
+  };
+
+  ESP_ERROR_CHECK( esp_console_cmd_register( &cmd ) );
+}
+
+#else
+
 static void mqtt_publish_rx( struct mqtt_data *ctxt, char const *ts, char const *msg ) {
-  cJSON *json = cJSON_CreateObject();
-  char *rx;
+  // Room for both strings even if some characters need escaping
+  char rx[ 2*( MSG_LINE_MAX + MSG_TIMESTAMP ) ];
   char topic[64];
+  size_t len;
 
-  char *end = strstr( msg,"\r\n");
-  if( end ) end[0] = '\0';
-
-  cJSON_AddStringToObject( json, "msg", msg );
-  cJSON_AddStringToObject( json, "ts",  ts );
+  len = mqtt_json_rx( rx, sizeof(rx), msg, ts );
+  if( !len ) {
+    ESP_LOGW( TAG, "RX too long <%s>", msg );
+    return;
+  }
 
-  rx = cJSON_Print( json );
   sprintf( topic, "%s/rx", ctxt->topic );
-  esp_mqtt_client_publish( ctxt->client,topic, rx, 0, 1, 0 );
+  esp_mqtt_client_publish( ctxt->client,topic, rx, len, 1, 0 );
+}
 
-  cJSON_Delete( json );
+TickType_t MQTT_publish_rx_poll( void ) {
+  return portMAX_DELAY;
 }
 
 void MQTT_publish_rx( char const *ts, char const *msg ) {
@@ -209,6 +376,8 @@ void MQTT_publish_rx( char const *ts, char const *msg ) {
     mqtt_publish_rx( ctxt, ts, msg );
 }
 
+#endif
+
 /*******************************************************************************
  * TX message
  */
@@ -219,17 +388,30 @@ static void mqtt_subscribe_tx( struct mqtt_data *ctxt ) {
 }
 
 static void mqtt_process_tx( struct mqtt_data *ctxt, char const *data, int dataLen ) {
-  cJSON *json, *msg;
+  char value[256];
+  int len;
 
   ESP_LOGI( TAG, "TX:<%.*s> %s", dataLen,data,esp_log_system_timestamp() );
 
-  json = cJSON_Parse( data );
-  msg = cJSON_GetObjectItem( json, "msg" );
+  if( dataLen<=0 )
+    return;
 
-  ESP_LOGD( TAG, "<%s>", msg->valuestring );
-  gateway_tx( msg->valuestring );
+  // Frame bytes as hex bypass the text format
+  len = mqtt_json_string( data, dataLen, "frame", value, 2*MSG_TX_FRAME_MAX+1 );
+  if( len>=0 ) {
+    if( gateway_tx_hex( value, len ) )
+      ESP_LOGW( TAG, "Bad TX frame <%s>", value );
+    return;
+  }
+
+  len = mqtt_json_string( data, dataLen, "msg", value, sizeof(value) );
+  if( len<0 ) {
+    ESP_LOGW( TAG, "Bad TX <%.*s>", dataLen,data );
+    return;
+  }
 
-  cJSON_Delete( json );
+  ESP_LOGD( TAG, "<%s>", value );
+  gateway_tx( value );
 }
 
 /*******************************************************************************
@@ -427,6 +609,10 @@ MQTT_HNDL ramses_mqtt_init( BaseType_t coreID ) {
 
   esp_log_level_set(TAG, CONFIG_MQTT_LOG_LEVEL );
 
+#if CONFIG_MQTT_RX_BATCH
+  mqtt_register_batch();
+#endif
+
   xTaskCreatePinnedToCore( Mqtt, "MQTT", 4096, ctxt, 10, &ctxt->task, ctxt->coreID );
 
   return ctxt;
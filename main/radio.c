@@ -13,6 +13,7 @@ static const char *TAG = "RADIO";
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "cc1101.h"
 #include "frame.h"
 #include "message.h"
 
@@ -34,6 +35,7 @@ void Radio_Task(void *arg)
   frame_init();
   msg_init();
 
+  // frame_work() blocks until there is radio work to do
   while(1){
     frame_work();
     msg_work();
@@ -62,5 +64,9 @@ void Radio_init( BaseType_t coreID ) {
 
   ctxt->coreID = coreID;
 
+  cc_register();
+  frame_register();
+  msg_register();
+
   xTaskCreatePinnedToCore( Radio_Task,  "Radio",  4096, ctxt, 20, &ctxt->task, ctxt->coreID );
 }
@@ -0,0 +1,82 @@
+/********************************************************************
+ * ramses_esp
+ * manchester_test.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Host test for the combined Manchester RX table
+ *
+ * Checks all 256 entries of man_rx[] against man_decode[] and
+ * man_encode[]. Also checks them against a bit pair decode that
+ * does not use any of the tables.
+ *
+ * Build and run:
+ *   cc -I../components/frame -o manchester_test manchester_test.c
+ *   ./manchester_test
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "manchester.h"
+
+static unsigned failures;
+
+static void fail( char const *what, unsigned code, unsigned got, unsigned want ) {
+  failures++;
+  printf("FAIL %s 0x%02X got 0x%02X want 0x%02X\n", what, code, got, want );
+}
+
+// Each bit pair, low pair first, is 10 for a 0 and 01 for a 1
+static uint8_t bit_decode( uint8_t code ) {
+  uint8_t value = 0;
+  uint8_t i;
+
+  for( i=0 ; i<4 ; i++ ) {
+    uint8_t pair = ( code >> ( 2*i ) ) & 0x3;
+    if( pair==0x1 )
+      value |= 1 << i;
+    else if( pair!=0x2 )
+      return MAN_INVALID;
+  }
+
+  return value;
+}
+
+int main( void ) {
+  unsigned code, value, nValid = 0;
+
+  for( code=0 ; code<256 ; code++ ) {
+    uint8_t hi = man_decode[ code>>4 ];
+    uint8_t lo = man_decode[ code&0xF ];
+    uint8_t want = ( hi==0xF || lo==0xF ) ? MAN_INVALID : ( hi<<2 | lo );
+
+    if( MAN_RX( code )!=want )
+      fail( "man_decode[]", code, MAN_RX( code ), want );
+
+    if( MAN_RX( code )!=bit_decode( code ) )
+      fail( "bit decode", code, MAN_RX( code ), bit_decode( code ) );
+
+    if( MAN_RX( code )!=MAN_INVALID )
+      nValid++;
+  }
+
+  // Every value encodes to a valid code that decodes back to it
+  for( value=0 ; value<16 ; value++ ) {
+    uint8_t code = man_encode[value];
+
+    if( manchester_encode( value )!=code )
+      fail( "manchester_encode", value, manchester_encode( value ), code );
+
+    if( MAN_RX( code )!=value )
+      fail( "man_encode[]", code, MAN_RX( code ), value );
+  }
+
+  // ...and those are the only valid codes
+  if( nValid!=16 )
+    fail( "valid codes", 0, nValid, 16 );
+
+  printf("256 codes, %u valid, %s\n", nValid, failures ? "FAILED" : "ok" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+/********************************************************************
+ * ramses_esp
+ * mqtt_json_bench.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Host benchmark of mqtt_json.c against cJSON
+ *
+ * Times the rx and tx topic paths both ways. The cJSON side does what
+ * ramses-mqtt.c did before: cJSON_Print() of a new object for every
+ * frame published, and cJSON_Parse() of every TX command. Unlike the
+ * old code it also frees the printed string.
+ * Heap calls are counted through cJSON_InitHooks().
+ *
+ * Before timing, every line is checked both ways. cJSON parses each
+ * mqtt_json_rx() payload back to the same msg and ts, and
+ * mqtt_json_string() agrees with cJSON on every TX command.
+ *
+ * Build and run, cJSON is the copy in ESP-IDF:
+ *   cc -O2 -I../components/ramses-mqtt -I$IDF_PATH/components/json/cJSON \
+ *      -o mqtt_json_bench mqtt_json_bench.c ../components/ramses-mqtt/mqtt_json.c \
+ *      $IDF_PATH/components/json/cJSON/cJSON.c
+ *   ./mqtt_json_bench [iterations]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "cJSON.h"
+#include "mqtt_json.h"
+
+#define BUF_SIZE 512
+
+static char const * const rxLines[] = {
+  "045  I --- 01:145038 --:------ 01:145038 1F09 003 FF04B5",
+  "058 RQ --- 18:000730 01:145038 --:------ 0004 002 0500",
+  "072 RP --- 01:145038 18:000730 --:------ 0004 022 05004C6F756E676500000000000000000000000000000000",
+  "066  I --- 04:189082 --:------ 01:145038 3150 002 0000",
+  "--- RP --- 10:048122 18:126620 --:------ 3220 005 00C0110000",
+  "081  W --- 30:082155 32:132403 --:------ 22F1 003 000204",
+  "070  I --- 01:145038 --:------ 01:145038 000A 048 001001F40DAC011001F40DAC021001F40DAC031001F40DAC041001F40DAC051001F40DAC061001F40DAC07",
+};
+
+static char const * const tsLines[] = {
+  "2025-01-31T23:59:59.999999+00:00",
+  "2025-06-01T08:30:00.000123+01:00",
+};
+
+static char const * const txLines[] = {
+  "{\"msg\":\" I --- 18:000730 --:------ 18:000730 1FC9 006 0022F16EE0A2\"}",
+  "{\"msg\":\"RQ --- 18:000730 01:145038 --:------ 0004 002 0500\"}",
+  "{ \"msg\" : \"RQ --- 18:000730 01:145038 --:------ 2309 001 00\" }",
+  "{\"ts\":\"2025-01-31T23:59:59.999999+00:00\",\"msg\":\" W --- 18:000730 32:132403 --:------ 22F1 003 000204\"}",
+  "{\"frame\":\"0C18000730C845C62309010012\"}",
+  "{\"id\":7,\"opts\":{\"retry\":[1,2,3]},\"msg\":\"RQ --- 18:000730 10:048122 --:------ 3220 005 0000110000\"}",
+  "{\"msg\":\"RQ --- 18:000730 01:145038 --:------ 0004 002 0\\u0035\\/00\"}",
+};
+
+#define N(_a) ( sizeof(_a)/sizeof(_a[0]) )
+
+/********************************************************
+** Heap accounting for cJSON
+********************************************************/
+static unsigned long nMalloc;
+
+static void *count_malloc( size_t size ) {
+  nMalloc++;
+  return malloc( size );
+}
+
+/********************************************************
+** The two implementations of each path
+********************************************************/
+static volatile size_t sink;
+
+static void rx_new( char const *msg, char const *ts ) {
+  char buf[BUF_SIZE];
+  sink += mqtt_json_rx( buf, sizeof(buf), msg, ts );
+}
+
+static void rx_cjson( char const *msg, char const *ts, int formatted ) {
+  cJSON *json = cJSON_CreateObject();
+  char *rx;
+
+  cJSON_AddStringToObject( json, "msg", msg );
+  cJSON_AddStringToObject( json, "ts",  ts );
+
+  rx = formatted ? cJSON_Print( json ) : cJSON_PrintUnformatted( json );
+  sink += strlen( rx );
+
+  cJSON_free( rx );
+  cJSON_Delete( json );
+}
+
+static void tx_new( char const *data ) {
+  char value[BUF_SIZE];
+  size_t len = strlen( data );
+
+  if( mqtt_json_string( data, len, "frame", value, sizeof(value) ) < 0 )
+    sink += mqtt_json_string( data, len, "msg", value, sizeof(value) );
+}
+
+static void tx_cjson( char const *data ) {
+  cJSON *json = cJSON_Parse( data );
+  cJSON *item = cJSON_GetObjectItem( json, "frame" );
+
+  if( !cJSON_IsString( item ) )
+    item = cJSON_GetObjectItem( json, "msg" );
+  if( cJSON_IsString( item ) )
+    sink += strlen( item->valuestring );
+
+  cJSON_Delete( json );
+}
+
+/********************************************************
+** Cross check
+********************************************************/
+static unsigned failures;
+
+static void check_rx( char const *msg, char const *ts ) {
+  char buf[BUF_SIZE];
+  cJSON *json, *m, *t;
+
+  if( !mqtt_json_rx( buf, sizeof(buf), msg, ts ) ) {
+    failures++;
+    printf("FAIL rx <%s> did not fit\n", msg );
+    return;
+  }
+
+  json = cJSON_Parse( buf );
+  m = cJSON_GetObjectItem( json, "msg" );
+  t = cJSON_GetObjectItem( json, "ts" );
+  if( !cJSON_IsString( m ) || !cJSON_IsString( t ) || strcmp( m->valuestring, msg ) || strcmp( t->valuestring, ts ) ) {
+    failures++;
+    printf("FAIL rx <%s>\n", buf );
+  }
+  cJSON_Delete( json );
+}
+
+static void check_tx_key( char const *data, char const *key ) {
+  char value[BUF_SIZE];
+  cJSON *json = cJSON_Parse( data );
+  cJSON *item = cJSON_GetObjectItem( json, key );
+  int n = mqtt_json_string( data, strlen( data ), key, value, sizeof(value) );
+
+  if( cJSON_IsString( item ) ? ( n<0 || strcmp( value, item->valuestring ) ) : ( n>=0 ) ) {
+    failures++;
+    printf("FAIL tx \"%s\" in <%s>\n", key, data );
+  }
+  cJSON_Delete( json );
+}
+
+/********************************************************
+** Timing
+********************************************************/
+static double now( void ) {
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+#define BENCH( _name, _n, _call ) do { \
+    unsigned long _i, _m = nMalloc; \
+    double _t = now(); \
+    for( _i=0 ; _i<(_n) ; _i++ ) { _call; } \
+    _t = now() - _t; \
+    printf("%-26s %8.1f ns %6.2f mallocs\n", _name, _t*1e9/(_n), (double)( nMalloc-_m )/(_n) ); \
+  } while(0)
+
+int main( int argc, char **argv ) {
+  unsigned long n = ( argc>1 ) ? strtoul( argv[1], NULL, 0 ) : 1000000;
+  cJSON_Hooks hooks = { count_malloc, free };
+  unsigned i, j;
+
+  cJSON_InitHooks( &hooks );
+
+  for( i=0 ; i<N(rxLines) ; i++ ) {
+    for( j=0 ; j<N(tsLines) ; j++ )
+      check_rx( rxLines[i], tsLines[j] );
+  }
+  check_rx( "quote \" backslash \\ tab \t", tsLines[0] );
+
+  for( i=0 ; i<N(txLines) ; i++ ) {
+    check_tx_key( txLines[i], "msg" );
+    check_tx_key( txLines[i], "frame" );
+  }
+
+  if( failures ) {
+    printf("%u differences from cJSON, FAILED\n", failures );
+    return 1;
+  }
+
+  printf("%lu iterations per path\n", n );
+  BENCH( "rx mqtt_json_rx",           n, rx_new( rxLines[_i%N(rxLines)], tsLines[_i%N(tsLines)] ) );
+  BENCH( "rx cJSON_Print",            n, rx_cjson( rxLines[_i%N(rxLines)], tsLines[_i%N(tsLines)], 1 ) );
+  BENCH( "rx cJSON_PrintUnformatted", n, rx_cjson( rxLines[_i%N(rxLines)], tsLines[_i%N(tsLines)], 0 ) );
+  BENCH( "tx mqtt_json_string",       n, tx_new( txLines[_i%N(txLines)] ) );
+  BENCH( "tx cJSON_Parse",            n, tx_cjson( txLines[_i%N(txLines)] ) );
+
+  return 0;
+}
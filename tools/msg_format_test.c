@@ -0,0 +1,263 @@
+/********************************************************************
+ * ramses_esp
+ * msg_format_test.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Host test comparing msg_format() with msg_print_all()
+ *
+ * msg_print_all() is the sprintf formatter msg_format() replaced in
+ * the firmware, kept here as the reference. Errors and raw bytes were
+ * never printed by it so those states are left out.
+ *
+ * Formats a large corpus of random messages, and the corner cases of
+ * every field, with both formatters. The lines must be byte for byte
+ * identical. msg_format() must also refuse a buffer one byte short
+ * and never write past the size it is given.
+ *
+ * Build and run:
+ *   cc -I../components/message/include -I../components/message \
+ *      -o msg_format_test msg_format_test.c ../components/message/msg_format.c
+ *   ./msg_format_test [count]
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "message.h"
+#include "msg.h"
+
+/********************************************************
+** Reference formatter
+********************************************************/
+#define _MSG_TYPE(_e,_t) _t,
+static char const * const MsgType[MSG_TYPE_MAX] = { _MSG_TYPE_LIST };
+#undef _MSG_TYPE
+
+// As in message.c
+void msg_decode_address( uint8_t *addr, uint8_t *class, uint32_t *id ) {
+  if( class ) (*class) = ( addr[0] & 0xFC ) >> 2;
+  if( id    ) (*id   ) = (uint32_t)( addr[0] & 0x03 ) << 16 | (uint32_t)addr[1] << 8 | addr[2];
+}
+
+static uint8_t msg_print_rssi( char *str, uint8_t rssi, uint8_t valid ) {
+  if( valid )
+    return sprintf( str, "%03u ", rssi );
+  return sprintf( str, "--- " );
+}
+
+static uint8_t msg_print_type( char *str, uint8_t type ) {
+  return sprintf( str, "%2s ", MsgType[type] );
+}
+
+static uint8_t msg_print_addr( char *str, uint8_t *addr, uint8_t valid ) {
+  if( valid ) {
+    uint8_t class;
+    uint32_t id;
+    msg_decode_address( addr, &class, &id );
+    return sprintf( str, "%02u:%06lu ", class, (unsigned long)id );
+  }
+  return sprintf( str, "--:------ " );
+}
+
+static uint8_t msg_print_param( char *str, uint8_t param, uint8_t valid ) {
+  if( valid )
+    return sprintf( str, "%03u ", param );
+  return sprintf( str, "--- " );
+}
+
+static uint8_t msg_print_opcode( char *str, uint8_t *opcode, uint8_t valid ) {
+  if( valid )
+    return sprintf( str, "%02X%02X ", opcode[0], opcode[1] );
+  return sprintf( str, "???? " );
+}
+
+static uint8_t msg_print_len( char *str, uint8_t len, uint8_t valid ) {
+  if( valid )
+    return sprintf( str, "%03u ", len );
+  return sprintf( str, "??? " );
+}
+
+static uint8_t msg_print_payload( char *str, uint8_t payload ) {
+  return sprintf( str, "%02X", payload );
+}
+
+// One field per call, msg->state tracks progress
+static uint8_t msg_print_field( struct message *msg, char *buff ) {
+  uint8_t nBytes = 0;
+
+  switch( msg->state ) {
+  case S_START:
+    nBytes = msg_print_rssi( buff, msg->rssi, msg->rxFields&F_RSSI );
+    msg->state = S_HEADER;
+    break;
+
+  case S_HEADER:
+    nBytes = msg_print_type( buff, msg->fields & F_MASK );
+    msg->state = S_PARAM0;
+    break;
+
+  case S_PARAM0:
+    nBytes = msg_print_param( buff, msg->param[0], msg->rxFields&F_PARAM0 );
+    msg->state = S_ADDR0;
+    break;
+
+  case S_ADDR0:
+    nBytes = msg_print_addr( buff, msg->addr[0], msg->rxFields&F_ADDR0 );
+    msg->state = S_ADDR1;
+    break;
+
+  case S_ADDR1:
+    nBytes = msg_print_addr( buff, msg->addr[1], msg->rxFields&F_ADDR1 );
+    msg->state = S_ADDR2;
+    break;
+
+  case S_ADDR2:
+    nBytes = msg_print_addr( buff, msg->addr[2], msg->rxFields&F_ADDR2 );
+    msg->state = S_OPCODE;
+    break;
+
+  case S_OPCODE:
+    nBytes = msg_print_opcode( buff, msg->opcode, msg->rxFields&F_OPCODE );
+    msg->state = S_LEN;
+    break;
+
+  case S_LEN:
+    nBytes = msg_print_len( buff, msg->len, msg->rxFields&F_LEN );
+    msg->state = S_PAYLOAD;
+    break;
+
+  case S_PAYLOAD:
+    if( msg->count < msg->nPayload ) {
+      nBytes = msg_print_payload( buff, msg->payload[msg->count++] );
+      break;
+    }
+    msg->count = 0;
+    msg->state = S_COMPLETE;
+    break;
+
+  default:
+    msg->state = S_COMPLETE;
+    break;
+  }
+
+  return nBytes;
+}
+
+static uint8_t msg_print_all( struct message *msg, char *msg_buff ) {
+  uint8_t len = 0;
+
+  msg->state = S_START;
+  msg->count = 0;
+  do {
+    len += msg_print_field( msg, msg_buff+len );
+  } while( msg->state != S_COMPLETE );
+
+  return len;
+}
+
+/********************************************************
+** Test
+********************************************************/
+static unsigned long failures;
+
+static void random_message( struct message *msg ) {
+  uint8_t i;
+
+  memset( msg, 0, sizeof(*msg) );
+
+  msg->rxFields = rand();
+  msg->fields   = rand();
+  msg->rssi     = rand();
+  msg->param[0] = rand();
+  msg->param[1] = rand();
+  for( i=0 ; i<sizeof(msg->addr) ; i++ )
+    msg->addr[i/3][i%3] = rand();
+  msg->opcode[0] = rand();
+  msg->opcode[1] = rand();
+  msg->len       = rand();
+  msg->nPayload  = rand() % ( MAX_PAYLOAD+1 );
+  for( i=0 ; i<msg->nPayload ; i++ )
+    msg->payload[i] = rand();
+
+  // Errors are not printed by either formatter
+  if( !( rand() % 4 ) )
+    msg->error = 1 + rand() % MSG_ERR_MAX;
+}
+
+// The values where a field's width could change
+static void edge_message( struct message *msg, unsigned long k ) {
+  static uint8_t const bytes[] = { 0x00, 0x09, 0x0A, 0x63, 0x64, 0x9F, 0xA0, 0xFF };
+  uint8_t b = bytes[ k % sizeof(bytes) ];
+  uint8_t i;
+
+  memset( msg, 0, sizeof(*msg) );
+
+  msg->rxFields  = ( k / sizeof(bytes) ) & 0xFF;
+  msg->fields    = k & F_MASK;
+  msg->rssi      = b;
+  msg->param[0]  = b;
+  for( i=0 ; i<sizeof(msg->addr) ; i++ )
+    msg->addr[i/3][i%3] = b;
+  msg->opcode[0] = b;
+  msg->opcode[1] = ~b;
+  msg->len       = b;
+  msg->nPayload  = ( k & 1 ) ? MAX_PAYLOAD : ( k % 3 );
+  memset( msg->payload, b, msg->nPayload );
+}
+
+static void compare( struct message *msg, unsigned long k ) {
+  char old[256], line[MSG_LINE_MAX+8];
+  uint8_t nOld;
+  uint16_t n;
+
+  memset( old, 0x01, sizeof(old) );
+  nOld = msg_print_all( msg, old );
+
+  memset( line, 0x02, sizeof(line) );
+  n = msg_format( msg, line, MSG_LINE_MAX );
+
+  if( n!=nOld || strcmp( old, line ) ) {
+    if( failures++ < 10 )
+      printf("FAIL %lu\n  msg_print_all <%s>\n  msg_format    <%s>\n", k, old, line );
+    return;
+  }
+
+  // Exactly n+1 bytes are needed and nothing beyond <size> is touched
+  memset( line, 0x02, sizeof(line) );
+  if( msg_format( msg, line, n ) || line[n] != 0x02 ) {
+    if( failures++ < 10 )
+      printf("FAIL %lu accepted a buffer of %u\n", k, n );
+    return;
+  }
+
+  memset( line, 0x02, sizeof(line) );
+  if( msg_format( msg, line, n+1 )!=n || line[n+1] != 0x02 ) {
+    if( failures++ < 10 )
+      printf("FAIL %lu buffer of %u\n", k, n+1 );
+  }
+}
+
+int main( int argc, char **argv ) {
+  unsigned long count = ( argc>1 ) ? strtoul( argv[1], NULL, 0 ) : 1000000;
+  unsigned long k;
+  struct message msg;
+
+  srand( 1 );
+
+  for( k=0 ; k<8*256 ; k++ ) {
+    edge_message( &msg, k );
+    compare( &msg, k );
+  }
+
+  for( k=0 ; k<count ; k++ ) {
+    random_message( &msg );
+    compare( &msg, k );
+  }
+
+  printf("%lu messages, %s\n", 8*256 + count, failures ? "FAILED" : "ok" );
+
+  return failures ? 1 : 0;
+}
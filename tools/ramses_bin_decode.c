@@ -0,0 +1,122 @@
+/********************************************************************
+ * ramses_esp
+ * ramses_bin_decode.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Host decoder for the binary serial protocol
+ *
+ * Reads the serial stream on stdin after 'binary on' and prints
+ * each record in the HGI80 text layout. Anything that isn't a valid
+ * record, such as console text, is skipped.
+ *
+ * The output is not identical to msg_format(). Each line starts with
+ * the record's sequence number and time, and errored frames end with
+ * " * ERR <code>" and their raw bytes, which msg_format() leaves out.
+ *
+ * Build:
+ *   cc -I../components/message/include -o ramses_bin_decode \
+ *      ramses_bin_decode.c ../components/message/msg_bin.c
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "msg_bin.h"
+
+static char const * const msgType[4] = { "RQ", " I", " W", "RP" };
+
+static void print_addr( uint8_t const *addr, uint8_t valid ) {
+  if( valid ) {
+    uint8_t class = ( addr[0] & 0xFC ) >> 2;
+    uint32_t id = (uint32_t)( addr[0] & 0x03 ) << 16 | (uint32_t)addr[1] << 8 | addr[2];
+    printf("%02u:%06" PRIu32 " ", class, id );
+  } else {
+    printf("--:------ ");
+  }
+}
+
+static void print_rx( uint32_t seq, struct msg_bin_rx const *rx ) {
+  uint8_t f = rx->rxFields;
+  uint8_t i;
+
+  printf("%10" PRIu32 " %14" PRId64 " ", seq, rx->time );
+
+  if( f & MSG_BIN_F_RSSI ) printf("%03u ", rx->rssi ); else printf("--- ");
+  printf("%s ", msgType[ rx->fields & MSG_BIN_TYPE_MASK ] );
+  if( f & MSG_BIN_F_PARAM0 ) printf("%03u ", rx->param[0] ); else printf("--- ");
+  print_addr( rx->addr[0], f & MSG_BIN_F_ADDR0 );
+  print_addr( rx->addr[1], f & MSG_BIN_F_ADDR1 );
+  print_addr( rx->addr[2], f & MSG_BIN_F_ADDR2 );
+  if( f & MSG_BIN_F_OPCODE ) printf("%02X%02X ", rx->opcode[0], rx->opcode[1] ); else printf("???? ");
+  if( f & MSG_BIN_F_LEN ) printf("%03u ", rx->len ); else printf("??? ");
+  for( i=0 ; i<rx->nPayload ; i++ )
+    printf("%02X", rx->payload[i] );
+
+  if( rx->error ) {
+    printf(" * ERR %u", rx->error );
+    if( rx->nRaw ) {
+      printf(" RAW ");
+      for( i=0 ; i<rx->nRaw ; i++ )
+        printf("%02X", rx->raw[i] );
+    }
+  }
+
+  printf("\n");
+}
+
+static void decode_record( uint8_t const *enc, size_t nEnc ) {
+  uint8_t rec[MSG_BIN_RX_MAX];
+  size_t n = msg_bin_cobs_decode( enc, nEnc, rec, sizeof(rec) );
+  uint8_t type;
+  uint32_t seq;
+  int nBody;
+
+  if( !n )
+    return;
+
+  nBody = msg_bin_check( rec, n, &type, &seq );
+  if( nBody < 0 )
+    return;
+
+  switch( type ) {
+  case MSG_BIN_RX: {
+      struct msg_bin_rx rx;
+      if( !msg_bin_unpack_rx( rec+MSG_BIN_HDR, nBody, &rx ) )
+        print_rx( seq, &rx );
+    }
+    break;
+
+  case MSG_BIN_STATUS:
+    if( nBody==1 )
+      printf("# STATUS seq=%" PRIu32 " result=%u\n", seq, rec[MSG_BIN_HDR] );
+    break;
+
+  default:
+    break;
+  }
+}
+
+int main( void ) {
+  static uint8_t enc[ MSG_BIN_COBS_MAX( MSG_BIN_RX_MAX ) ];
+  size_t nEnc = 0;
+  int overflow = 0;
+  int c;
+
+  while( ( c = getchar() ) != EOF ) {
+    if( c ) {
+      if( nEnc < sizeof(enc) )
+        enc[nEnc++] = c;
+      else
+        overflow = 1;
+    } else {
+      if( !overflow )
+        decode_record( enc, nEnc );
+      nEnc = 0;
+      overflow = 0;
+    }
+  }
+
+  return 0;
+}
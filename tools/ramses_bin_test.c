@@ -0,0 +1,296 @@
+/********************************************************************
+ * ramses_esp
+ * ramses_bin_test.c
+ *
+ * (C) 2025 Peter Price
+ *
+ * Host round-trip test for the binary serial protocol
+ *
+ * Random RX messages, including errored frames with raw bytes, are
+ * packed, framed and COBS encoded into one stream. Console text,
+ * corrupted records and truncated records are mixed in between.
+ * The stream is then split on 0x00 as ramses_bin_decode does and every
+ * good record must come back unchanged and in order. None of the
+ * damaged ones may get through.
+ *
+ * Build and run:
+ *   cc -I../components/message/include -o ramses_bin_test \
+ *      ramses_bin_test.c ../components/message/msg_bin.c
+ *   ./ramses_bin_test
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "msg_bin.h"
+
+#define N_RECORDS 20000
+#define STREAM_MAX ( N_RECORDS * ( MSG_BIN_RECORD_MAX + 64 ) )
+
+enum rec_kind {
+  REC_GOOD,
+  REC_CORRUPT,    // One byte of the encoded record changed
+  REC_TRUNCATED,  // Cut short, the next record's leading 0x00 ends it
+};
+
+struct expect {
+  uint8_t type;
+  uint32_t seq;
+  struct msg_bin_rx rx;   // MSG_BIN_RX only
+  uint8_t status;         // MSG_BIN_STATUS only
+};
+
+static struct expect expect[N_RECORDS];
+static uint32_t nExpect, nNext;
+static uint32_t nDecoded, nRejected, failures;
+
+static uint8_t stream[STREAM_MAX];
+static size_t nStream;
+
+static char const * const console[] = {
+  "I (123456) GATEWAY: Task Started\r\n",
+  "# binary on\n",
+  "W (98765) SINK: Dropped < * ERR 3>\r\n",
+  "E (1) ",
+};
+
+static uint32_t rnd( uint32_t n ) {
+  return (uint32_t)rand() % n;
+}
+
+static void fail( char const *what, uint32_t seq ) {
+  if( failures++ < 10 )
+    printf("FAIL %s seq=%" PRIu32 "\n", what, seq );
+}
+
+/********************************************************
+** Generate
+********************************************************/
+static void random_bytes( uint8_t *p, size_t n, uint8_t noZero ) {
+  while( n-- ) {
+    uint8_t b = rnd( 256 );
+    *(p++) = ( noZero && !b ) ? 0xFF : b;
+  }
+}
+
+static void random_rx( struct msg_bin_rx *rx ) {
+  // Some messages have no zero bytes at all to exercise long COBS runs
+  uint8_t noZero = !rnd( 8 );
+
+  memset( rx, 0, sizeof(*rx) );
+  rx->time = ( (int64_t)rnd( 1u<<31 ) << 20 ) | rnd( 1u<<20 );
+  rx->rssi = rnd( 256 );
+  rx->rxFields = rnd( 256 );
+  rx->fields = rnd( 256 );
+  random_bytes( &rx->addr[0][0], sizeof(rx->addr), noZero );
+  random_bytes( rx->param, sizeof(rx->param), noZero );
+  random_bytes( rx->opcode, sizeof(rx->opcode), noZero );
+  rx->len = rnd( 256 );
+  rx->nPayload = rnd( MSG_BIN_PAYLOAD+1 );
+  random_bytes( rx->payload, rx->nPayload, noZero );
+
+  // Errored frames carry their raw bytes
+  if( !rnd( 4 ) ) {
+    rx->error = 1 + rnd( 20 );
+    rx->nRaw = rnd( MSG_BIN_RAW+1 );
+    random_bytes( rx->raw, rx->nRaw, noZero );
+  }
+
+  if( noZero ) {
+    if( !rx->rssi ) rx->rssi = 1;
+    if( !rx->rxFields ) rx->rxFields = 1;
+    if( !rx->fields ) rx->fields = 1;
+    if( !rx->len ) rx->len = 1;
+  }
+}
+
+static void add_console_text( void ) {
+  char const *text = console[ rnd( sizeof(console)/sizeof(console[0]) ) ];
+  size_t n = strlen( text );
+
+  memcpy( stream+nStream, text, n );
+  nStream += n;
+}
+
+static void add_record( uint32_t seq ) {
+  struct expect *e = expect + nExpect;
+  uint8_t body[MSG_BIN_RX_MAX];
+  uint8_t rec[MSG_BIN_RECORD_MAX];
+  enum rec_kind kind = REC_GOOD;
+  size_t nBody, n;
+  uint32_t r = rnd( 20 );
+
+  if( r==0 )      kind = REC_CORRUPT;
+  else if( r==1 ) kind = REC_TRUNCATED;
+
+  e->seq = seq;
+  if( rnd( 10 ) ) {
+    e->type = MSG_BIN_RX;
+    random_rx( &e->rx );
+    nBody = msg_bin_pack_rx( &e->rx, body, sizeof(body) );
+    if( !nBody ) {
+      fail( "pack", seq );
+      return;
+    }
+  } else {
+    e->type = MSG_BIN_STATUS;
+    e->status = rnd( 256 );
+    body[0] = e->status;
+    nBody = 1;
+  }
+
+  n = msg_bin_record( e->type, seq, body, nBody, rec, sizeof(rec) );
+  if( !n || n > MSG_BIN_RECORD_MAX || rec[0] || rec[n-1] || memchr( rec+1, 0, n-2 ) ) {
+    fail( "record", seq );
+    return;
+  }
+
+  if( kind==REC_CORRUPT ) {
+    // Never 0x00, that would just split the record in two
+    size_t at = 1 + rnd( n-2 );
+    rec[at] ^= 1 + rnd( 255 );
+    if( !rec[at] )
+      rec[at] = 0x5A;
+  } else if( kind==REC_TRUNCATED ) {
+    // Keep the leading 0x00, lose the terminator and at least one byte.
+    // Losing only the terminator is harmless, the next 0x00 ends it.
+    n = 2 + rnd( n-3 );
+  }
+
+  memcpy( stream+nStream, rec, n );
+  nStream += n;
+
+  if( kind==REC_GOOD )
+    nExpect++;
+}
+
+/********************************************************
+** Decode and check
+********************************************************/
+static int same_rx( struct msg_bin_rx const *a, struct msg_bin_rx const *b ) {
+  return a->time==b->time && a->rssi==b->rssi && a->rxFields==b->rxFields
+      && a->fields==b->fields && a->error==b->error
+      && !memcmp( a->addr, b->addr, sizeof(a->addr) )
+      && !memcmp( a->param, b->param, sizeof(a->param) )
+      && !memcmp( a->opcode, b->opcode, sizeof(a->opcode) )
+      && a->len==b->len
+      && a->nPayload==b->nPayload && !memcmp( a->payload, b->payload, a->nPayload )
+      && a->nRaw==b->nRaw && !memcmp( a->raw, b->raw, a->nRaw );
+}
+
+static void check_record( uint8_t const *enc, size_t nEnc ) {
+  uint8_t rec[MSG_BIN_RX_MAX];
+  size_t n = msg_bin_cobs_decode( enc, nEnc, rec, sizeof(rec) );
+  struct expect const *e;
+  uint8_t type;
+  uint32_t seq;
+  int nBody;
+
+  nBody = n ? msg_bin_check( rec, n, &type, &seq ) : -1;
+  if( nBody < 0 ) {
+    nRejected++;
+    return;
+  }
+
+  if( nNext >= nExpect ) {
+    fail( "unexpected record", seq );
+    return;
+  }
+
+  e = expect + nNext++;
+  nDecoded++;
+
+  if( type!=e->type || seq!=e->seq ) {
+    fail( "damaged record passed or good record lost", seq );
+    nNext--;    // Resynchronise on the next good one
+    return;
+  }
+
+  if( type==MSG_BIN_RX ) {
+    struct msg_bin_rx rx;
+    if( msg_bin_unpack_rx( rec+MSG_BIN_HDR, nBody, &rx ) )
+      fail( "unpack", seq );
+    else if( !same_rx( &rx, &e->rx ) )
+      fail( "RX fields differ", seq );
+  } else if( nBody!=1 || rec[MSG_BIN_HDR]!=e->status ) {
+    fail( "status differs", seq );
+  }
+}
+
+static void decode_stream( void ) {
+  static uint8_t enc[ MSG_BIN_COBS_MAX( MSG_BIN_RX_MAX ) ];
+  size_t nEnc = 0;
+  int overflow = 0;
+  size_t i;
+
+  for( i=0 ; i<nStream ; i++ ) {
+    uint8_t c = stream[i];
+    if( c ) {
+      if( nEnc < sizeof(enc) )
+        enc[nEnc++] = c;
+      else
+        overflow = 1;
+    } else {
+      if( overflow )
+        nRejected++;
+      else if( nEnc )
+        check_record( enc, nEnc );
+      nEnc = 0;
+      overflow = 0;
+    }
+  }
+}
+
+/********************************************************
+** COBS edge cases
+********************************************************/
+static void check_cobs( void ) {
+  static uint16_t const lens[] = { 0, 1, 253, 254, 255, 508, 509, 512 };
+  uint8_t src[512], enc[MSG_BIN_COBS_MAX(512)], dec[512];
+  uint8_t i, fill;
+
+  for( fill=0 ; fill<2 ; fill++ ) {
+    for( i=0 ; i<sizeof(lens)/sizeof(lens[0]) ; i++ ) {
+      size_t n = lens[i];
+      size_t nEnc, nDec;
+
+      memset( src, fill ? 0x11 : 0x00, sizeof(src) );
+      nEnc = msg_bin_cobs_encode( src, n, enc );
+      if( nEnc > MSG_BIN_COBS_MAX(n) || enc[nEnc-1] || memchr( enc, 0, nEnc-1 ) ) {
+        fail( "COBS encode", n );
+        continue;
+      }
+
+      nDec = msg_bin_cobs_decode( enc, nEnc-1, dec, sizeof(dec) );
+      if( nDec!=n || memcmp( src, dec, n ) )
+        fail( "COBS decode", n );
+    }
+  }
+}
+
+int main( void ) {
+  uint32_t seq;
+
+  srand( 1 );
+
+  check_cobs();
+
+  for( seq=0 ; seq<N_RECORDS ; seq++ ) {
+    if( !rnd( 4 ) )
+      add_console_text();
+    add_record( seq );
+  }
+
+  decode_stream();
+
+  if( nNext!=nExpect )
+    fail( "good records missing", nNext );
+
+  printf("%" PRIu32 " records decoded, %" PRIu32 " rejected, %u bytes, %s\n",
+         nDecoded, nRejected, (unsigned)nStream, failures ? "FAILED" : "ok" );
+
+  return failures ? 1 : 0;
+}